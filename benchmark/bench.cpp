@@ -0,0 +1,471 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include "threadpool.h"
+
+/*
+线程池基准测试：每个场景都分别在MODE_FIXED和MODE_CACHED下运行
+1.空任务吞吐量：不同线程数下提交并执行空任务的速度
+2.提交到开始执行的延迟：线程空闲时提交单个任务，统计延迟的百分位数
+3.多生产者竞争：多个线程同时调用submitTask
+4.fan-out/fan-in：把一个计算拆成多个Task提交，再逐个Result::get()合并结果
+5.突发负载：提交一批阻塞任务，cached模式下测量创建线程和回收线程的耗时
+6.多核扩展性：多个生产者同时提交空任务，线程数到32以上(超过CPU核心数时同样运行)，观察吞吐量随线程数的变化
+  线程池成员的布局由编译选项决定，分别按默认布局和THREADPOOL_PACKED_LAYOUT编译后运行，对比两种布局的扩展性
+7.伪共享对比：每个线程累加自己的计数，计数紧挨着存放和按缓存行对齐存放的速度对比
+
+编译：g++ -std=c++17 -O2 -I. benchmark/bench.cpp threadpool.cpp -o bench -lpthread
+不对齐布局：g++ -std=c++17 -O2 -I. -DTHREADPOOL_PACKED_LAYOUT benchmark/bench.cpp threadpool.cpp -o bench_packed -lpthread
+运行：./bench [--quick] [--reap] [--threads N] [--scaling]
+--quick 减少任务数量，用于快速检查
+--reap  等待cached模式回收空闲线程(约需ElasticPolicy::idleTimeout)
+--threads N 场景6、7的最大线程数，默认为CPU核心数和64中较大的一个
+--scaling 只运行场景6，用于对比./bench和./bench_packed
+*/
+
+using Clock = std::chrono::steady_clock;
+using uLong = unsigned long long;
+
+static int scale_ = 1; // --quick时为10，各场景的任务数除以该值
+
+// 编译时选择的线程池成员布局，场景6的结果中注明
+#ifdef THREADPOOL_PACKED_LAYOUT
+static const char* layoutName_ = "packed";
+#else
+static const char* layoutName_ = "padded";
+#endif
+
+static double elapsedSec(Clock::time_point since)
+{
+    return std::chrono::duration<double>(Clock::now() - since).count();
+}
+
+static uint64_t elapsedNs(Clock::time_point since)
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count());
+}
+
+static const char* modeName(PoolMode mode)
+{
+    return mode == PoolMode::MODE_FIXED ? "fixed" : "cached";
+}
+
+// 创建并启动线程池，加大任务队列上限避免测试中出现提交失败
+static void startPool(ThreadPool& pool, PoolMode mode, int threadSize)
+{
+    pool.setMode(mode);
+    pool.setTaskQueMaxThreshold(1 << 16);
+    pool.start(threadSize);
+}
+
+// 输出一行结果
+static void report(const std::string& scenario, const char* mode, const std::string& param, const std::string& value)
+{
+    std::cout << std::left << std::setw(14) << scenario
+        << std::setw(8) << mode
+        << std::setw(18) << param
+        << value << std::endl;
+}
+
+static void report(const std::string& scenario, PoolMode mode, const std::string& param, const std::string& value)
+{
+    report(scenario, modeName(mode), param, value);
+}
+
+// 场景1：空任务吞吐量
+static void benchThroughput(PoolMode mode, int threadSize)
+{
+    const int taskSize = 200000 / scale_;
+    ThreadPool pool;
+    startPool(pool, mode, threadSize);
+
+    std::vector<TaskFuture<void>> futures;
+    futures.reserve(taskSize);
+    auto begin = Clock::now();
+    for (int i = 0; i < taskSize; i++)
+    {
+        futures.emplace_back(pool.submitTask([]() {}));
+    }
+    for (auto& future : futures)
+    {
+        future.wait();
+    }
+    double sec = elapsedSec(begin);
+
+    report("throughput", mode, "threads=" + std::to_string(threadSize),
+        std::to_string(static_cast<uLong>(taskSize / sec)) + " tasks/s");
+}
+
+// 场景2：提交到开始执行的延迟，每次提交一个任务并等待完成，保证线程处于空闲等待状态
+static void benchLatency(PoolMode mode, int threadSize)
+{
+    const int sampleSize = 20000 / scale_;
+    ThreadPool pool;
+    startPool(pool, mode, threadSize);
+
+    // 不调用get()：get()会在任务还没被取走时直接在调用线程执行它，测不到分发延迟
+    std::vector<uint64_t> samples(sampleSize);
+    std::atomic_int finished(0);
+    for (int i = 0; i < sampleSize; i++)
+    {
+        auto submitTime = Clock::now();
+        pool.submitTask([&samples, &finished, submitTime, i]() {
+            samples[i] = elapsedNs(submitTime);
+            finished.store(i + 1, std::memory_order_release);
+        });
+        while (finished.load(std::memory_order_acquire) <= i)
+        {
+            std::this_thread::yield();
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+
+    auto at = [&](double p) { return std::to_string(samples[static_cast<size_t>(p * (samples.size() - 1))]); };
+    report("latency", mode, "threads=" + std::to_string(threadSize),
+        "p50=" + at(0.5) + "ns p99=" + at(0.99) + "ns p999=" + at(0.999) + "ns max=" + at(1.0) + "ns");
+}
+
+// 场景3：多生产者同时提交任务
+static void benchProducers(PoolMode mode, int threadSize, int producerSize)
+{
+    const int taskSize = 200000 / scale_;
+    const int perProducer = taskSize / producerSize;
+    ThreadPool pool;
+    startPool(pool, mode, threadSize);
+
+    std::atomic_int finished(0);
+    std::atomic_bool go(false);
+    std::vector<std::thread> producers;
+    for (int i = 0; i < producerSize; i++)
+    {
+        producers.emplace_back([&]() {
+            while (!go.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            for (int j = 0; j < perProducer; j++)
+            {
+                pool.submitTask([&finished]() { finished.fetch_add(1, std::memory_order_relaxed); });
+            }
+        });
+    }
+
+    auto begin = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+    double submitSec = elapsedSec(begin);
+    // 任务队列满时可能提交失败，只等待提交成功的任务
+    uint64_t submitted = pool.stats().submitted;
+    while (static_cast<uint64_t>(finished.load(std::memory_order_relaxed)) < submitted)
+    {
+        std::this_thread::yield();
+    }
+    double sec = elapsedSec(begin);
+
+    report("producers", mode, "producers=" + std::to_string(producerSize),
+        "submit " + std::to_string(static_cast<uLong>(submitted / submitSec)) + " tasks/s, total "
+        + std::to_string(static_cast<uLong>(submitted / sec)) + " tasks/s");
+}
+
+// 场景4用到的求和任务，和example/main.cpp中的用法相同
+class SumTask : public Task
+{
+public:
+    SumTask(uLong begin, uLong end) :begin_(begin), end_(end) {}
+    Any run()
+    {
+        uLong sum = 0;
+        for (uLong i = begin_; i <= end_; i++)
+        {
+            sum += i;
+        }
+        return sum;
+    }
+
+private:
+    uLong begin_;
+    uLong end_;
+};
+
+// 场景4：fan-out/fan-in，每轮把区间拆成fanOut个Task，再用Result::get()合并
+static void benchFanOut(PoolMode mode, int threadSize, int fanOut)
+{
+    const int roundSize = 2000 / scale_;
+    const uLong rangeSize = 10000;
+    ThreadPool pool;
+    startPool(pool, mode, threadSize);
+
+    uLong check = 0;
+    auto begin = Clock::now();
+    for (int round = 0; round < roundSize; round++)
+    {
+        std::vector<Result> results;
+        results.reserve(fanOut);
+        for (int i = 0; i < fanOut; i++)
+        {
+            results.emplace_back(pool.submitTask(
+                std::make_shared<SumTask>(i * rangeSize + 1, (i + 1) * rangeSize)));
+        }
+        uLong sum = 0;
+        for (auto& result : results)
+        {
+            sum += result.get().cast_<uLong>();
+        }
+        check += sum;
+    }
+    double sec = elapsedSec(begin);
+
+    uLong n = fanOut * rangeSize;
+    bool ok = check == roundSize * (n * (n + 1) / 2);
+    report("fanout", mode, "tasks=" + std::to_string(fanOut),
+        std::to_string(static_cast<uLong>(roundSize / sec)) + " rounds/s" + (ok ? "" : " (wrong sum!)"));
+}
+
+// 场景5：突发负载，提交burstSize个阻塞任务，测量全部任务开始执行的耗时
+// cached模式下会创建新线程(reserveSize>0时先唤醒预先创建的保留线程)，waitReap为true时继续等待空闲线程被回收
+static void benchBurst(PoolMode mode, int threadSize, int burstSize, bool waitReap, int reserveSize = 0)
+{
+    ThreadPool pool;
+    ElasticPolicy policy;
+    policy.reserveThreads = reserveSize;
+    pool.setElasticPolicy(policy);
+    startPool(pool, mode, threadSize);
+
+    std::atomic_int started(0);
+    std::atomic_bool release(false);
+    std::vector<TaskFuture<void>> futures;
+    auto begin = Clock::now();
+    for (int i = 0; i < burstSize; i++)
+    {
+        futures.emplace_back(pool.submitTask([&]() {
+            started.fetch_add(1, std::memory_order_relaxed);
+            while (!release.load(std::memory_order_acquire))
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }));
+    }
+    // fixed模式下线程数不增长，只能等到已开始的任务结束，所以只等待线程数个任务开始执行
+    int expect = mode == PoolMode::MODE_CACHED ? burstSize : std::min(burstSize, threadSize);
+    while (started.load(std::memory_order_relaxed) < expect && elapsedSec(begin) < 10)
+    {
+        std::this_thread::yield();
+    }
+    double startSec = elapsedSec(begin);
+    int startedSize = started.load(std::memory_order_relaxed);
+    release.store(true, std::memory_order_release);
+    for (auto& future : futures)
+    {
+        future.wait();
+    }
+    double sec = elapsedSec(begin);
+
+    PoolStats stats = pool.stats();
+    std::string value = std::to_string(startedSize) + " started in "
+        + std::to_string(static_cast<uLong>(startSec * 1e6)) + "us, all done in "
+        + std::to_string(static_cast<uLong>(sec * 1e6)) + "us, spawns="
+        + std::to_string(stats.threadSpawns) + ", activations=" + std::to_string(stats.threadActivations);
+    if (stats.threadSpawns > 0)
+    {
+        value += " (" + std::to_string(static_cast<uLong>(startSec * 1e6 / stats.threadSpawns)) + "us/spawn)";
+    }
+
+    if (waitReap && mode == PoolMode::MODE_CACHED)
+    {
+        auto reapBegin = Clock::now();
+        while (pool.stats().curThreads > threadSize && elapsedSec(reapBegin) < 30)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        value += ", reaps=" + std::to_string(pool.stats().threadReaps) + " in "
+            + std::to_string(static_cast<uLong>(elapsedSec(reapBegin) * 1e3)) + "ms";
+    }
+    report("burst", mode, "burst=" + std::to_string(burstSize)
+        + (reserveSize > 0 ? " rsv=" + std::to_string(reserveSize) : ""), value);
+}
+
+// 场景6：多核扩展性，threadSize个线程执行、threadSize/4个生产者同时提交空任务
+// 工作线程每执行一个任务都修改的共享计数(伪共享)会让吞吐量在线程数增加时不升反降
+static void benchScaling(PoolMode mode, int threadSize)
+{
+    const int taskSize = 400000 / scale_;
+    const int producerSize = std::max(1, threadSize / 4);
+    const int perProducer = taskSize / producerSize;
+    ThreadPool pool;
+    pool.setTaskQueMode(TaskQueMode::QUE_LOCKFREE);
+    startPool(pool, mode, threadSize);
+
+    std::atomic_int finished(0);
+    std::atomic_bool go(false);
+    std::vector<std::thread> producers;
+    for (int i = 0; i < producerSize; i++)
+    {
+        producers.emplace_back([&]() {
+            while (!go.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            for (int j = 0; j < perProducer; j++)
+            {
+                pool.submitTask([&finished]() { finished.fetch_add(1, std::memory_order_relaxed); });
+            }
+        });
+    }
+
+    auto begin = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+    uint64_t submitted = pool.stats().submitted;
+    while (static_cast<uint64_t>(finished.load(std::memory_order_relaxed)) < submitted)
+    {
+        std::this_thread::yield();
+    }
+    double sec = elapsedSec(begin);
+
+    report("scaling", mode, "threads=" + std::to_string(threadSize) + " " + layoutName_,
+        std::to_string(static_cast<uLong>(submitted / sec)) + " tasks/s");
+}
+
+// 场景7用到的计数：紧挨着存放时多个计数共享一个缓存行，对齐存放时每个计数独占一个缓存行
+struct PackedCounter
+{
+    std::atomic<uint64_t> value_{ 0 };
+};
+struct alignas(64) PaddedCounter
+{
+    std::atomic<uint64_t> value_{ 0 };
+};
+
+// threadSize个线程各自累加自己的计数，返回所有线程合计每秒累加的次数
+template<typename Counter>
+static double countRate(int threadSize)
+{
+    const int countSize = 2000000 / scale_;
+    std::vector<Counter> counters(threadSize);
+    std::atomic_bool go(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadSize; i++)
+    {
+        threads.emplace_back([&, i]() {
+            while (!go.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            for (int j = 0; j < countSize; j++)
+            {
+                counters[i].value_.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    auto begin = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    return static_cast<double>(countSize) * threadSize / elapsedSec(begin);
+}
+
+// 场景7：伪共享对比
+static void benchFalseSharing(int threadSize)
+{
+    double packed = countRate<PackedCounter>(threadSize);
+    double padded = countRate<PaddedCounter>(threadSize);
+    report("falseshare", "-", "threads=" + std::to_string(threadSize),
+        "packed " + std::to_string(static_cast<uLong>(packed)) + " ops/s, padded "
+        + std::to_string(static_cast<uLong>(padded)) + " ops/s");
+}
+
+int main(int argc, char** argv)
+{
+    bool waitReap = false;
+    bool scalingOnly = false;
+    int maxThreads = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--quick") == 0) scale_ = 10;
+        else if (std::strcmp(argv[i], "--reap") == 0) waitReap = true;
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) maxThreads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--scaling") == 0) scalingOnly = true;
+    }
+
+    int hardware = std::max(1u, std::thread::hardware_concurrency());
+    if (maxThreads <= 0)
+    {
+        maxThreads = std::max(hardware, 64);
+    }
+    // 场景6、7的线程数：从1开始按2倍增长到maxThreads
+    std::vector<int> scaleSizes;
+    for (int n = 1; n < maxThreads; n *= 2)
+    {
+        scaleSizes.push_back(n);
+    }
+    scaleSizes.push_back(maxThreads);
+    std::vector<int> threadSizes;
+    for (int n = 1; n < hardware; n *= 2)
+    {
+        threadSizes.push_back(n);
+    }
+    threadSizes.push_back(hardware);
+
+    const PoolMode modes[] = { PoolMode::MODE_FIXED, PoolMode::MODE_CACHED };
+    if (scalingOnly)
+    {
+        for (PoolMode mode : modes)
+        {
+            for (int threadSize : scaleSizes)
+            {
+                benchScaling(mode, threadSize);
+            }
+        }
+        return 0;
+    }
+    for (PoolMode mode : modes)
+    {
+        for (int threadSize : threadSizes)
+        {
+            benchThroughput(mode, threadSize);
+        }
+        benchLatency(mode, 1);
+        if (hardware > 1)
+        {
+            benchLatency(mode, hardware);
+        }
+        for (int producerSize : { 1, 4, 16 })
+        {
+            benchProducers(mode, hardware, producerSize);
+        }
+        for (int fanOut : { 4, 64 })
+        {
+            benchFanOut(mode, hardware, fanOut);
+        }
+        benchBurst(mode, 2, 32, waitReap);
+        if (mode == PoolMode::MODE_CACHED)
+        {
+            benchBurst(mode, 2, 32, false, 32);
+        }
+        for (int threadSize : scaleSizes)
+        {
+            benchScaling(mode, threadSize);
+        }
+    }
+    for (int threadSize : scaleSizes)
+    {
+        benchFalseSharing(threadSize);
+    }
+    return 0;
+}
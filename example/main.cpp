@@ -130,5 +130,17 @@ int main()
     // Master线程合并各个任务结果并输出
     std::cout << (sum1 + sum2 + sum3) << std::endl;*/
 
+    /*//example 4: 用parallelReduce代替手工切分区间和合并结果
+    ThreadPool pool;
+    pool.start();
+    uLong sum = pool.parallelReduce(uLong(1), uLong(300000001), uLong(0),
+        [](uLong begin, uLong end) {
+            uLong sum = 0;
+            for (uLong i = begin; i < end; i++) sum += i;
+            return sum;
+        },
+        [](uLong a, uLong b) { return a + b; });
+    std::cout << sum << std::endl;*/
+
     getchar();
 }
\ No newline at end of file
@@ -4,27 +4,149 @@
 *	     作者：zy
 */
 #include "threadpool.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <climits>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
 
 const int TASK_MAX_THRESHOLD = 1024; // 任务队列最大任务数
 const int THREAD_MAX_THRESHOLD = 100; // 线程队列最大线程数
-const int THREAD_MAX_IDLE_TIME = 10; // 线程最大空闲时间，单位：秒
+const std::chrono::milliseconds SUBMIT_TIMEOUT(1000); // 任务队列满时提交线程默认的最长等待时间
+const int STRAND_BATCH_SIZE = 64; // Strand的排空任务连续执行的最大任务数，之后重新提交排空任务
+const uint64_t GROUP_STRIDE = uint64_t(1) << 20; // 执行器组stride调度的步长基数，组的步长为GROUP_STRIDE/权重
+const int GROUP_MAX_WEIGHT = 1 << 16; // 执行器组的最大权重
+const int TIMER_LEVEL0_BITS = 8; // 时间轮第0层256个槽位，每个槽位1ms
+const int TIMER_LEVEL_BITS = 6; // 时间轮第1~3层各64个槽位，每层的槽位跨度是下一层的整圈
+const int TIMER_LEVELS = 4; // 4层覆盖2^26ms(约18.6小时)，更远的定时器放在最高层，到时重新放置
+
+// 自旋等待时降低CPU占用、让出流水线给同一核心的另一个超线程
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// 工作窃取模式：当前线程所属的线程池及其私有任务队列，用于区分外部提交和线程池内部提交
+static thread_local ThreadPool* localPool_ = nullptr;
+static thread_local WorkStealingQueue* localQue_ = nullptr;
+static thread_local unsigned int stealSeed_ = 0; // 选取窃取对象的随机数种子
+static thread_local WorkerStats* localStats_ = nullptr; // 当前线程的统计计数槽位
+static thread_local int localIndex_ = -1; // MODE_STEALING：当前线程私有队列在workQues_中的下标
+static thread_local int helpDepth_ = 0; // 当前线程在等待中嵌套帮忙执行任务的层数
+static thread_local bool localBlocking_ = false; // 当前线程已经在阻塞区域中，嵌套的阻塞区域不再补偿
+const int MAX_HELP_DEPTH = 64; // 嵌套帮忙的最大层数，避免等待链过长时栈溢出
+
+// steady_clock的当前时间，单位：纳秒
+static inline int64_t steadyNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 距离某个时间点经过的纳秒数
+static inline uint64_t elapsedNs(std::chrono::steady_clock::time_point since,
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - since).count();
+    return ns > 0 ? static_cast<uint64_t>(ns) : 0;
+}
 
 /*************************线程池类方法实现*************************/
 // 线程池构造
 ThreadPool::ThreadPool()
     : initThreadSize_(4)
-    , taskSize_(0)
-    , taskQueMaxThreshold_(TASK_MAX_THRESHOLD)
-    , idleThreadSize_(0)
-    , curThreadSize_(0)
     , threadSizeThreshold_(THREAD_MAX_THRESHOLD)
+    , taskQueMaxThreshold_(TASK_MAX_THRESHOLD)
+    , overflowPolicy_(OverflowPolicy::OVERFLOW_BLOCK)
+    , submitTimeout_(SUBMIT_TIMEOUT)
     , poolMode_(PoolMode::MODE_FIXED)
+    , taskQueMode_(TaskQueMode::QUE_LOCKED)
     , isPoolRunning_(false)
-{}
+    , isShutdown_(false)
+    , curThreadSize_(0)
+    , taskSize_(0)
+    , waitingThreadSize_(0)
+    , waitingSubmitSize_(0)
+    , waitingNodeSubmitSize_(0)
+    , overflowSize_(0)
+    , reapPending_(0)
+    , reserveThreadSize_(0)
+    , reserveLimit_(0)
+    , activatePending_(0)
+    , threadStackSize_(0)
+    , blockingThreadSize_(0)
+    , compensation_(0)
+    , retirePending_(0)
+    , controllerRunning_(false)
+    , controllerParked_(false)
+    , submitted_(0)
+    , rejected_(0)
+    , submitBlockedNs_(0)
+    , threadSpawns_(0)
+    , threadReaps_(0)
+    , threadActivations_(0)
+    , compensations_(0)
+    , callerRuns_(0)
+    , dropped_(0)
+    , spilled_(0)
+    , canceled_(0)
+    , expired_(0)
+{
+    for (int& threshold : laneMaxThreshold_)
+    {
+        threshold = 0;
+    }
+}
 
 // 线程池析构
 ThreadPool::~ThreadPool()
 {
+    // 和原来一样执行完任务队列中的所有任务再回收线程，已经调用过shutdown()时直接返回
+    // 还没有到期的延迟任务不再执行，通知等待结果的线程
+    for (auto& task : shutdown(ShutdownMode::SHUTDOWN_DRAIN))
+    {
+        task->discard();
+    }
+}
+
+// 关闭线程池
+std::vector<std::shared_ptr<TaskBase>> ThreadPool::shutdown(ShutdownMode mode)
+{
+    if (mode == ShutdownMode::SHUTDOWN_DRAIN)
+    {
+        return shutdown(std::chrono::steady_clock::time_point::max());
+    }
+    return shutdown(std::chrono::steady_clock::now());
+}
+
+// 关闭线程池，到deadline还没有开始执行的任务不再执行
+std::vector<std::shared_ptr<TaskBase>> ThreadPool::shutdown(std::chrono::steady_clock::time_point deadline)
+{
+    std::vector<std::shared_ptr<TaskBase>> pending;
+    if (isShutdown_.exchange(true))
+    {
+        return pending;
+    }
+
+    // 先停止定时线程，还没有到期的延迟任务作为没有执行的任务返回
+    stopTimer(pending);
+    // 再停止弹性控制线程，之后不会再创建新线程
+    stopController();
+
+    std::unique_lock<std::mutex> lock(taskQueMtx_);
     isPoolRunning_ = false;
 
     // 放在这里有概率出现死锁
@@ -34,13 +156,105 @@ ThreadPool::~ThreadPool()
     // 然后线程函数获取锁，并notEmpty_.wait(),没有人能唤醒它，陷入死锁
     // 第四种情况：线程池里的线程先获取锁，然后进入wait状态把mutex释放掉
     // 然后pool拿到锁，却不释放notEmpty_，陷入死锁
-    // notEmpty_.notify_all(); // 唤醒处于等待状态的线程
+    // 因此在持有taskQueMtx_时修改isPoolRunning_并通知
+    notEmpty_.notify_all(); // 唤醒处于等待状态的线程
+    notFull_.notify_all(); // 唤醒因任务队列满而等待的提交线程，它们会返回SUBMIT_SHUTDOWN
+    reserveCond_.notify_all(); // 唤醒保留线程池中休眠的线程，它们直接退出
 
     // 等待线程池里所有线程返回
     // 两种状态： 1、阻塞 2、执行任务中
-    std::unique_lock<std::mutex> lock(taskQueMtx_);
-    notEmpty_.notify_all(); // 唤醒处于等待状态的线程
-    exitCond_.wait(lock, [&]()->bool {return threads_.size() == 0; });
+    // 线程在任务队列为空时退出；到了截止时间还有任务没有执行，就把它们从队列中取走，线程执行完手上的任务后退出
+    if (!exitCond_.wait_until(lock, deadline, [&]()->bool { return threads_.size() == 0; }))
+    {
+        takePending(pending);
+        notEmpty_.notify_all();
+        // 正在执行的任务提交的子任务不受影响，线程执行完之后队列为空才退出
+        exitCond_.wait(lock, [&]()->bool { return threads_.size() == 0; });
+    }
+    lock.unlock();
+    joinExited();
+    return pending;
+}
+
+// 停止弹性控制线程
+void ThreadPool::stopController()
+{
+    if (!controller_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> ctrlLock(ctrlMtx_);
+        controllerRunning_ = false;
+    }
+    ctrlCond_.notify_all();
+    controller_.join();
+}
+
+// 线程退出前把自己的Thread对象移到exitedThreads_
+void ThreadPool::retireThread(int threadId)
+{
+    auto it = threads_.find(threadId);
+    exitedThreads_.emplace_back(std::move(it->second));
+    threads_.erase(it);
+}
+
+// join()已经退出的线程
+void ThreadPool::joinExited()
+{
+    std::vector<std::unique_ptr<Thread>> exited;
+    {
+        std::lock_guard<std::mutex> lock(taskQueMtx_);
+        exited.swap(exitedThreads_);
+    }
+    for (auto& thread : exited)
+    {
+        thread->join();
+    }
+}
+
+// 取出所有队列中还没有执行的任务
+void ThreadPool::takePending(std::vector<std::shared_ptr<TaskBase>>& pending)
+{
+    // 取得执行权的任务才返回，已经被等待的线程直接执行过的只是队列中残留的记录
+    auto take = [&](std::shared_ptr<TaskBase> task) {
+        int expected = TaskBase::TASK_QUEUED;
+        if (task->runState_.compare_exchange_strong(expected, TaskBase::TASK_CLAIMED, std::memory_order_acq_rel))
+        {
+            task->submitStatus_.store(SubmitStatus::SUBMIT_SHUTDOWN, std::memory_order_release);
+            pending.emplace_back(std::move(task));
+        }
+    };
+    while (!taskQue_.empty())
+    {
+        take(taskQue_.pop());
+        taskSize_--;
+    }
+    while (!overflowQue_.empty())
+    {
+        take(std::move(overflowQue_.front()));
+        overflowQue_.pop_front();
+        overflowSize_--;
+    }
+    std::shared_ptr<TaskBase> task;
+    while (lockFreeQue_ != nullptr && lockFreeQue_->pop(task))
+    {
+        taskSize_--;
+        take(std::move(task));
+    }
+    for (auto& que : workQues_)
+    {
+        while (que->steal(task))
+        {
+            taskSize_--;
+            take(std::move(task));
+        }
+    }
+}
+
+// 设置工作线程的栈大小
+void ThreadPool::setThreadStackSize(size_t bytes)
+{
+    if (checkRunningState())
+        return;
+    threadStackSize_ = bytes;
 }
 
 // 设置线程池工作模式
@@ -57,276 +271,3961 @@ void ThreadPool::setTaskQueMaxThreshold(int threshold)
     taskQueMaxThreshold_ = threshold;
 }
 
-// 设置线程池cached模式下线程阈值
-void ThreadPool::setThreadSizeThreshold(int threshold)
+// 设置任务队列实现方式
+void ThreadPool::setTaskQueMode(TaskQueMode mode)
 {
     if (checkRunningState()) return;
-    if (poolMode_ == PoolMode::MODE_CACHED)
-        threadSizeThreshold_ = threshold;
+    taskQueMode_ = mode;
 }
 
-// 给线程池提交任务--用户调用该接口，传入任务对象，生产任务
-Result ThreadPool::submitTask(std::shared_ptr<Task> task)
+// 设置某个优先级队列的最大任务数量
+void ThreadPool::setLaneMaxThreshold(TaskPriority priority, int threshold)
 {
-    // 获取锁
-    std::unique_lock<std::mutex> lock(taskQueMtx_);
+    if (checkRunningState()) return;
+    laneMaxThreshold_[static_cast<int>(priority)] = threshold;
+}
 
-    // 线程通信：条件变量释放锁并等待任务队列有空余
-    // 用户提交任务，最长不能阻塞超过1s,否则判断提交任务失败，返回
-    // 使用lambda表达式判断是否要wait()
-    if(!notFull_.wait_for(lock, std::chrono::seconds(1), 
-        [&]()->bool {return taskQue_.size() < (size_t)taskQueMaxThreshold_;}))
+// 设置优先级老化时间
+void ThreadPool::setPriorityAging(std::chrono::milliseconds aging)
+{
+    if (checkRunningState()) return;
+    taskQue_.setAging(aging);
+}
+
+// 设置submitTask()遇到任务队列满时的处理方式
+void ThreadPool::setOverflowPolicy(OverflowPolicy policy)
+{
+    if (checkRunningState()) return;
+    overflowPolicy_ = policy;
+}
+
+// 设置任务队列满时提交线程的最长等待时间
+void ThreadPool::setSubmitTimeout(std::chrono::milliseconds timeout)
+{
+    if (checkRunningState()) return;
+    submitTimeout_ = timeout;
+}
+
+// 设置线程空闲等待策略
+void ThreadPool::setIdlePolicy(const IdlePolicy& policy)
+{
+    if (checkRunningState()) return;
+    idlePolicy_ = policy;
+}
+
+// 设置MODE_CACHED的弹性伸缩策略，线程池运行中也可以修改
+void ThreadPool::setElasticPolicy(const ElasticPolicy& policy)
+{
     {
-        // 表示not_Full_等待1s，条件依然没有满足，输出日志并返回
-        std::cerr << "task queue is full, submit task fail." << std::endl;
-        return Result(task, false);
+        std::lock_guard<std::mutex> lock(ctrlMtx_);
+        elasticPolicy_ = policy;
     }
-    
-    // 如果有空余，把任务放入任务队列中
-    taskQue_.emplace(task);
-    taskSize_++;  //submitTask()所在的线程是用户线程，而线程函数所在的线程是另外的线程，因此需要用atomic保证线程安全
+    ctrlCond_.notify_all();
+}
 
-    // 因为新放了任务，任务队列不空了，在not_empty_上通知赶快分配线程执行任务
-    notEmpty_.notify_all();
+// 设置线程池的线程阈值：cached模式下的扩容上限，各模式下阻塞补偿线程的上限
+// 只有MODE_CACHED由弹性控制线程按阈值扩容，其他模式只在阻塞补偿时检查
+void ThreadPool::setThreadSizeThreshold(int threshold)
+{
+    if (checkRunningState()) return;
+    threadSizeThreshold_ = threshold;
+}
 
-    // MODE_CACHED模式：需要根据任务数量和空闲线程数量，判断是否需要创建新的线程
-    // cached模式：场景小而快的任务；fixed模式：比较耗时的任务
-    if (poolMode_ == PoolMode::MODE_CACHED
-        && taskSize_ > idleThreadSize_
-        && curThreadSize_ < threadSizeThreshold_)
+// 给线程池提交任务--用户调用该接口，传入任务对象，生产任务
+Result ThreadPool::submitTask(std::shared_ptr<Task> task, TaskPriority priority)
+{
+    task->priority_ = priority;
+    if (!isAccepted(enqueueTask(task, overflowPolicy_)))
     {
-        std::cout << ">>> create new threads ..." << std::endl;
-        // 创建新线程
-        auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
-        int threadId = ptr->getId();
-        threads_.emplace(threadId, std::move(ptr));
-        // 启动线程
-        threads_[threadId]->start(); 
-        // 修改线程个数相关的变量
-        curThreadSize_++;
-        idleThreadSize_++;
+        return Result(task, false, this);
     }
     // 返回任务的Result对象
     // 不推荐写成return task->getResult();
     // 因为随着task任务被执行完，task对象没了，依赖于task对象的Result对象也没了
     // Result对象的生命周期应该要设计得更长，要让用户可以调用到res.get()
     // Result(task)只要Result对象还在，task对象就还在
-    return Result(task);
+    return Result(task, true, this);
 }
 
-// 开启线程池
-void ThreadPool::start(int initThreadSize)
+// 按提交选项提交任务
+Result ThreadPool::submitTask(std::shared_ptr<Task> task, const TaskOptions& options)
 {
-    // 设置线程池运行状态
-    isPoolRunning_ = true;
-
-    // 记录初始线程个数
-    initThreadSize_ = initThreadSize;
-    curThreadSize_ = initThreadSize;
-
-    // 创建线程对象
-    for (int i = 0; i < initThreadSize_; i++)
+    applyOptions(*task, options);
+    if (!isAccepted(enqueueTask(task, overflowPolicy_)))
     {
-        // 创建thread线程对象的时候，把当前线程池对象的线程函数给到thread线程对象
-        auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
-        int threadId = ptr->getId();
-        threads_.emplace(threadId, std::move(ptr)); // unique_ptr禁止左值引用的拷贝和赋值，但可以右值引用
+        return Result(task, false, this);
     }
-    // 启动所有线程
-    for (int i = 0; i < initThreadSize_; i++)
+    return Result(task, true, this);
+}
+
+// 提交任务，从不阻塞
+Result ThreadPool::trySubmit(std::shared_ptr<Task> task, TaskPriority priority)
+{
+    task->priority_ = priority;
+    if (!isAccepted(enqueueTask(task, OverflowPolicy::OVERFLOW_REJECT)))
     {
-        threads_[i]->start(); // 去执行一个线程函数
-        idleThreadSize_++; // 记录初始空闲线程的数量
+        return Result(task, false, this);
     }
+    return Result(task, true, this);
 }
 
-//定义线程函数--线程池里面的线程从任务队列中消费任务
-void ThreadPool::threadFunc(int threadId)
+// 提交任务，任务队列满时最多等待到deadline
+Result ThreadPool::submitUntil(std::chrono::steady_clock::time_point deadline, std::shared_ptr<Task> task,
+    TaskPriority priority)
 {
-    auto lastTime = std::chrono::high_resolution_clock().now();
+    task->priority_ = priority;
+    if (!isAccepted(enqueueTask(task, OverflowPolicy::OVERFLOW_BLOCK, deadline)))
+    {
+        return Result(task, false, this);
+    }
+    return Result(task, true, this);
+}
 
-    // 等所有任务必须执行完成，线程池才可以回收所有线程资源：for (;;)
-    // 原本：while (isPoolRunning_)
-    for (;;) // 死循环
+// 提交then()的后续任务，线程池已经停止或任务队列满时直接在当前线程执行
+// 回调在完成前一个任务的线程中执行，不能在任务队列满时阻塞等待
+void ThreadPool::submitContinuation(const std::shared_ptr<TaskBase>& task)
+{
+    // 线程池已经关闭时enqueueTask()返回SUBMIT_SHUTDOWN，同样在当前线程执行
+    if (!isPoolRunning_ || !isAccepted(enqueueTask(task, OverflowPolicy::OVERFLOW_CALLER_RUNS)))
     {
-        std::shared_ptr<Task> task;
-        {
-            // 获取锁
-            std::unique_lock<std::mutex> lock(taskQueMtx_);
+        task->exec();
+    }
+}
 
-            std::cout << "tid : " << std::this_thread::get_id() << " 尝试获取任务..." << std::endl;
+// 提交Strand的排空任务，返回是否提交成功
+bool ThreadPool::submitStrand(const std::shared_ptr<TaskBase>& task)
+{
+    // 任务队列满或线程池已经关闭时不阻塞，由调用者在当前线程继续排空
+    return isAccepted(enqueueTask(task, OverflowPolicy::OVERFLOW_REJECT));
+}
 
-            // MODE_CACHED：有可能已经创建了很多线程，但空闲时间超过60s,应该把多余线程结束回收
-            // 超过initThreadSize_数量的线程要进行回收
-            // 当前时间 - 上一次线程执行的时间 > 60s
+// 并行算法一次调用的共享状态：调用线程和辅助任务通过next_领取块，done_统计执行完的块
+struct ParallelState
+{
+    ParallelState(size_t count, void (*invoke)(void*, size_t), void* body)
+        : count_(count), invoke_(invoke), body_(body), next_(0), done_(0), failed_(false)
+    {}
 
-            // 每一秒返回一次 怎么区分超时返回还是有任务待执行返回 轮询
-            // 原本：锁 + 双重判断 ：while (isPoolRunning_ && taskQue_.size() == 0)
-            while (taskQue_.size() == 0)
+    // 领取并执行块，直到所有块都被领取
+    // 只有领取到有效块时才访问body_，所有块执行完后调用线程返回，body_随之失效，之后开始的辅助任务领取不到块
+    void work()
+    {
+        size_t chunk;
+        while ((chunk = next_.fetch_add(1, std::memory_order_relaxed)) < count_)
+        {
+            if (!failed_.load(std::memory_order_relaxed))
             {
-                // 检查是有任务被唤醒还是线程池结束回收线程资源被唤醒
-                if (!isPoolRunning_)
+                try
                 {
-                    threads_.erase(threadId);
-                    exitCond_.notify_all(); // 唤醒线程池析构函数中的条件变量
-                    std::cout << "threadid : " << std::this_thread::get_id() << " exit!" << std::endl;
-                    return; // 线程函数结束，线程结束
+                    invoke_(body_, chunk);
                 }
-
-                if (poolMode_ == PoolMode::MODE_CACHED)
+                catch (...)
                 {
-                    // 条件变量超时返回
-                    if (std::cv_status::timeout == 
-                    notEmpty_.wait_for(lock, std::chrono::seconds(1)))
-                    {
-                        auto now = std::chrono::high_resolution_clock().now();
-                        auto dur = std::chrono::duration_cast<std::chrono::seconds>(now - lastTime);
-                        if (dur.count() >= THREAD_MAX_IDLE_TIME
-                            && curThreadSize_ > initThreadSize_)
-                        {
-                            // 回收当前线程
-                            // 记录线程数量的相关变量的值修改
-                            // 把线程对象从线程列表容器中删除
-                            // 通过线程id找到线程对象进而删除
-                            threads_.erase(threadId);
-                            curThreadSize_--;
-                            idleThreadSize_--;
-                            std::cout << "threadid : " << std::this_thread::get_id() << " exit!" << std::endl;
-                            return;
-                        }
-                    }
+                    std::lock_guard<std::mutex> lock(errorMtx_);
+                    if (!error_) error_ = std::current_exception();
+                    failed_.store(true, std::memory_order_relaxed);
                 }
-                else // Fixed模式
-                {
-                    // 等待notEmpty_条件，任务队列size()大于 0 时不等待
-                    notEmpty_.wait(lock);
-                }   
-
-                // // 检查是有任务被唤醒还是线程池结束回收线程资源被唤醒
-                // if (!isPoolRunning_)
-                // {
-                //     threads_.erase(threadId);
-                //     exitCond_.notify_all(); // 唤醒线程池析构函数中的条件变量
-                //     std::cout << "threadid : " << std::this_thread::get_id() << " exit!" << std::endl;
-                //     return; // 结束线程函数就是结束当前线程了
-                // }             
             }
-
-            // // 检查是有任务被唤醒还是线程池结束回收线程资源被唤醒
-            // if (!isPoolRunning_)
-            // {
-            //     break;
-            // }
-
-            // 线程开始忙了，当前空闲线程减1
-            idleThreadSize_--;
-
-            std::cout << "tid : " << std::this_thread::get_id() << " 获取任务成功..." << std::endl;
-
-            // 从任务队列中取一个任务出来
-            task = taskQue_.front();
-            taskQue_.pop();
-            taskSize_--; 
-
-            // 如果本线程取出一个任务后仍然有剩余任务，继续通知其他线程执行任务
-            if (!taskQue_.empty())
+            if (done_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_)
             {
-                notEmpty_.notify_all();
+                finished_.set();
             }
-            // 通知生产者可以继续提交任务
-            notFull_.notify_all();           
-        }// 离开作用域释放锁
-
-        // 当前线程负责执行这个任务
-        if (task != nullptr)
-        {
-            // 执行任务并把任务的返回值通过srtVal()给到Result
-            task->exec();
-            // 输出
-            std::cout << "执行任务结束" << std::endl;
         }
-        // 已完成任务，当前空闲线程加1
-        idleThreadSize_++;
-        // 更新线程执行完任务的时间
-        lastTime = std::chrono::high_resolution_clock().now();
     }
-    // threads_.erase(threadId);
-    // std::cout << "threadid : " << std::this_thread::get_id() << " exit!" << std::endl;
-    // exitCond_.notify_all(); // 唤醒线程池析构函数中的条件变量
-}
-
-// 检查线程池运行状态
-bool ThreadPool::checkRunningState() const
-{
-    return isPoolRunning_;
-}
-/*************************线程类方法实现*************************/
-int Thread::generatedId_ = 0; // 静态成员变量类外初始化
-
-// 线程构造
-Thread::Thread(ThreadFunc func)
-    : func_(func)
-    , threadId_(generatedId_++)
-{}
 
-// 线程析构
-Thread::~Thread() {}
+    const size_t count_;
+    void (*invoke_)(void*, size_t);
+    void* body_;
+    alignas(64) std::atomic<size_t> next_; // 下一个待领取的块
+    alignas(64) std::atomic<size_t> done_; // 已经执行完的块数
+    std::atomic_bool failed_; // 有块抛出了异常，之后领取的块不再执行
+    std::mutex errorMtx_;
+    std::exception_ptr error_;
+    Completion finished_;
+};
 
-// 启动线程
-void Thread::start()
+// 辅助任务：在线程池的线程中参与领取块
+class ParallelTask : public TaskBase
 {
-    // 创建一个线程对象来执行线程函数，并向线程函数func_传递参数threadId_
-    std::thread t(func_,threadId_);
-    // 设置分离线程
-    // 因为线程对象t离开了作用域会消失，而t又和线程函数func_绑定在了一起，所以要分离线程
-    // 在调用detach()后，std::thread对象t不再与实际执行线程函数func_的线程相关联。
-    t.detach();
+public:
+    explicit ParallelTask(std::shared_ptr<ParallelState> state) : state_(std::move(state)) {}
+    void exec() override { state_->work(); }
 
-}
+private:
+    std::shared_ptr<ParallelState> state_;
+};
 
-// 获取线程ID
-int Thread::getId() const
+// 并行算法的块大小
+size_t ThreadPool::grainSize(size_t size, size_t grain) const
 {
-    return threadId_;
+    if (grain > 0) return grain;
+    // 调用线程也参与执行，按线程数+1计算；每个线程约8块，块执行时间不均匀时也能保持负载均衡
+    size_t workers = static_cast<size_t>(std::max(curThreadSize_.load(), 1)) + 1;
+    return std::max<size_t>(1, size / (workers * 8));
 }
 
-/*************************任务类方法实现*************************/
-// 构造
-Task::Task() : result_(nullptr) {}
-// 执行任务并把任务的返回值通过srtVal()给到Result
-void Task::exec()
-{
-    // 多态调用
-    if (result_ != nullptr)
-        result_->setVal(run());
-}
-// 设置Result
-void Task::setResult(Result* res)
-{
-    result_ = res;
-}
-/*************************Result类方法实现*************************/
-// 构造
-Result::Result(std::shared_ptr<Task> task, bool isValid)
-    : task_(task)
-    , isValid_(isValid)
+// 调用线程和辅助任务一起领取并执行count个块
+void ThreadPool::runParallel(size_t count, void (*invoke)(void*, size_t), void* body)
 {
-    task->setResult(this);
+    if (count == 0) return;
+    // 线程池没有运行或只有一块时直接在调用线程执行
+    if (count == 1 || !isPoolRunning_)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            invoke(body, i);
+        }
+        return;
+    }
+
+    auto state = makeTask<ParallelState>(count, invoke, body);
+    // 辅助任务数量不超过线程数和任务队列的剩余空间，避免提交辅助任务时阻塞调用线程
+    size_t helpers = std::min(count - 1, static_cast<size_t>(std::max(curThreadSize_.load(), 1)));
+    if (!(localPool_ == this && localQue_ != nullptr))
+    {
+        size_t queued = taskSize_;
+        size_t room = queued < static_cast<size_t>(taskQueMaxThreshold_) ? taskQueMaxThreshold_ - queued : 0;
+        helpers = std::min(helpers, room);
+    }
+    if (helpers > 0)
+    {
+        std::vector<std::shared_ptr<TaskBase>> tasks;
+        tasks.reserve(helpers);
+        for (size_t i = 0; i < helpers; i++)
+        {
+            tasks.emplace_back(makeTask<ParallelTask>(state));
+        }
+        enqueueBatch(tasks, TaskPriority::PRIORITY_NORMAL);
+    }
+
+    state->work();
+    // 其他线程还在执行最后几块
+    ParallelState* ptr = state.get();
+    helpWait(nullptr, [ptr]() { return ptr->finished_.isSet(); }, [ptr]() { ptr->finished_.wait(); });
+    if (state->error_)
+    {
+        std::rethrow_exception(state->error_);
+    }
 }
 
-// 线程池线程获取任务执行完的返回值记录在any_中，并通过信号量通知用户线程任务执行完成
-void Result::setVal(Any any)
+// 把任务提交给指定NUMA节点上的线程执行
+Result ThreadPool::submitTaskToNode(int node, std::shared_ptr<Task> task)
 {
-    // 存储task的返回值
-    this->any_ = std::move(any);
-    // 已经获取任务的返回值，增加信号量资源
-    sem_.release_();
+    task->numaNode_ = node;
+    if (!isAccepted(enqueueTask(task, overflowPolicy_)))
+    {
+        return Result(task, false, this);
+    }
+    return Result(task, true, this);
 }
 
-// 用户调用该方法获取task的返回值
-Any Result::get()
+// 把任务放入任务队列并记录统计信息，任务队列满时按policy处理
+SubmitStatus ThreadPool::enqueueTask(const std::shared_ptr<TaskBase>& task, OverflowPolicy policy,
+    std::chrono::steady_clock::time_point deadline)
 {
-        if(!isValid_) return "";
-        sem_.acquire_(); //任务如果没有执行完，阻塞用户线程
-        return std::move(any_);
+    // 入队之前记录时间，任务可能在入队后马上被执行
+    task->enqueueTime_ = std::chrono::steady_clock::now();
+    if (deadline == std::chrono::steady_clock::time_point())
+    {
+        deadline = task->enqueueTime_ + submitTimeout_;
+    }
+    // 线程池已经关闭：只接受线程池自己的线程(正在执行的任务)提交的子任务，关闭时一起执行完
+    if (isShutdown_ && localPool_ != this)
+    {
+        task->submitStatus_.store(SubmitStatus::SUBMIT_SHUTDOWN, std::memory_order_release);
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return SubmitStatus::SUBMIT_SHUTDOWN;
+    }
+    // 提交时已经取消或过期的任务不进入任务队列
+    if (task->isCanceled() || task->deadline_ <= task->enqueueTime_)
+    {
+        bool canceled = task->isCanceled();
+        (canceled ? canceled_ : expired_).fetch_add(1, std::memory_order_relaxed);
+        SubmitStatus status = canceled ? SubmitStatus::SUBMIT_CANCELED : SubmitStatus::SUBMIT_EXPIRED;
+        task->submitStatus_.store(status, std::memory_order_release);
+        return status;
+    }
+    task->submitStatus_.store(SubmitStatus::SUBMIT_OK, std::memory_order_relaxed);
+    task->runState_.store(TaskBase::TASK_QUEUED, std::memory_order_relaxed);
+#ifdef THREADPOOL_PROFILE
+    // 记录开启时给任务分配编号，导出时用来连接提交和执行
+    task->traceId_ = TaskTrace::enabled() ? TaskTrace::nextId() : 0;
+    if (task->traceId_ != 0) TaskTrace::record(TraceEventType::TRACE_SUBMIT, this, task->traceId_);
+#endif
+    SubmitStatus status = pushTask(task, policy, deadline);
+    if (!isAccepted(status))
+    {
+        task->runState_.store(TaskBase::TASK_CREATED, std::memory_order_relaxed);
+        task->submitStatus_.store(status, std::memory_order_release);
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        // 只有原来阻塞等待的提交方式保留日志，其他方式由调用者根据状态处理，不在拒绝时付出输出的开销
+        if (policy == OverflowPolicy::OVERFLOW_BLOCK)
+        {
+            std::cerr << submitStatusText(status) << std::endl;
+        }
+        return status;
+    }
+    // SUBMIT_OK在入队前已经记录；入队后任务可能已经被取消、过期或挤出，只在状态还是SUBMIT_OK时改写，
+    // 不覆盖discardTask()记录的最终状态。CALLER_RAN先记录状态再执行，任务执行完后等待者看到的状态就是最终状态
+    if (status != SubmitStatus::SUBMIT_OK)
+    {
+        SubmitStatus expected = SubmitStatus::SUBMIT_OK;
+        task->submitStatus_.compare_exchange_strong(expected, status, std::memory_order_acq_rel);
+    }
+    submitted_.fetch_add(1, std::memory_order_relaxed);
+    if (status == SubmitStatus::SUBMIT_SPILLED)
+    {
+        requestGrowth();
+    }
+    else if (status == SubmitStatus::SUBMIT_CALLER_RAN)
+    {
+        // OVERFLOW_CALLER_RUNS：任务没有入队，直接在提交线程中执行
+        task->runState_.store(TaskBase::TASK_CLAIMED, std::memory_order_relaxed);
+        callerRuns_.fetch_add(1, std::memory_order_relaxed);
+        executeTask(task);
+    }
+    return status;
+}
+
+// 按线程池模式和任务队列实现方式把任务放入对应的队列
+SubmitStatus ThreadPool::pushTask(const std::shared_ptr<TaskBase>& task, OverflowPolicy policy,
+    std::chrono::steady_clock::time_point deadline)
+{
+    // 指定了NUMA节点：放入该节点上随机一个线程的私有队列
+    int node = task->numaNode_;
+    if (node >= 0 && node < (int)nodeWorkers_.size() && !nodeWorkers_[node].empty())
+    {
+        return pushNodeTask(task, nodeWorkers_[node], policy, deadline);
+    }
+
+    // MODE_STEALING：线程池内的线程提交的任务直接放入自己的队列，不经过taskQueMtx_
+    if (localPool_ == this && localQue_ != nullptr)
+    {
+        // 先增加计数再入队，保证其他线程看到队列中的任务时taskSize_不会下溢
+        taskSize_++;
+        localQue_->push(task);
+        // 有线程在等待时才需要唤醒，加锁是为了避免和wait之间丢失通知
+        if (waitingThreadSize_ > 0)
+        {
+            std::lock_guard<std::mutex> lock(taskQueMtx_);
+            notEmpty_.notify_one();
+        }
+        return SubmitStatus::SUBMIT_OK;
+    }
+
+    // QUE_LOCKFREE：无锁入队，只有环形队列满了才按溢出策略处理
+    if (lockFreeQue_ != nullptr)
+    {
+        SubmitStatus status = pushLockFree(task, policy, deadline);
+        if (status != SubmitStatus::SUBMIT_OK)
+        {
+            return status;
+        }
+        if (waitingThreadSize_ > 0)
+        {
+            std::lock_guard<std::mutex> lock(taskQueMtx_);
+            notEmpty_.notify_one();
+        }
+        requestGrowth();
+        return SubmitStatus::SUBMIT_OK;
+    }
+
+    // 获取锁
+    std::unique_lock<std::mutex> lock(taskQueMtx_);
+
+    // 线程通信：条件变量释放锁并等待任务队列有空余
+    // 用户提交任务，最长不能阻塞超过deadline,否则判断提交任务失败，返回
+    // 使用lambda表达式判断是否要wait()
+    // 登记等待的提交线程数量，消费者只在有人等待时才通知notFull_
+    // OVERFLOW_SPILL：溢出队列中还有任务时新任务也要排在后面，保持提交顺序
+    bool ready = canAdmit(task->priority_)
+        && (policy != OverflowPolicy::OVERFLOW_SPILL || overflowQue_.empty());
+    std::shared_ptr<TaskBase> victim;
+    if (!ready)
+    {
+        switch (policy)
+        {
+        case OverflowPolicy::OVERFLOW_BLOCK:
+        {
+            auto blockStart = std::chrono::steady_clock::now();
+            waitingSubmitSize_++;
+            // 线程池关闭时不再等待，线程池自己的线程提交的子任务除外
+            ready = notFull_.wait_until(lock, deadline,
+                [&]()->bool {return canAdmit(task->priority_) || (isShutdown_ && localPool_ != this);});
+            waitingSubmitSize_--;
+            submitBlockedNs_.fetch_add(elapsedNs(blockStart), std::memory_order_relaxed);
+            if (!ready || !canAdmit(task->priority_))
+            {
+                // 表示not_Full_等待到截止时间，条件依然没有满足，返回
+                return ready ? SubmitStatus::SUBMIT_SHUTDOWN : SubmitStatus::SUBMIT_TIMEOUT;
+            }
+            break;
+        }
+        case OverflowPolicy::OVERFLOW_CALLER_RUNS:
+            return SubmitStatus::SUBMIT_CALLER_RAN;
+        case OverflowPolicy::OVERFLOW_DROP_OLDEST:
+        {
+            // 新任务所在的优先级队列达到了分道阈值时只能挤掉同一队列的任务，否则挤掉优先级不高于新任务的
+            // 队列中最低优先级队列里等待最久的任务；这些队列都为空时不挤掉更高优先级的任务，按队列满处理
+            int laneMax = laneMaxThreshold_[static_cast<int>(task->priority_)];
+            int lane = static_cast<int>(task->priority_);
+            if (laneMax <= 0 || taskQue_.size(task->priority_) < (size_t)laneMax)
+            {
+                lane = TASK_PRIORITY_SIZE - 1;
+                while (lane > static_cast<int>(task->priority_) && taskQue_.size(static_cast<TaskPriority>(lane)) == 0)
+                {
+                    lane--;
+                }
+            }
+            if (taskQue_.size(static_cast<TaskPriority>(lane)) == 0)
+            {
+                return SubmitStatus::SUBMIT_QUEUE_FULL;
+            }
+            victim = taskQue_.popFront(static_cast<TaskPriority>(lane));
+            taskSize_--;
+            break;
+        }
+        case OverflowPolicy::OVERFLOW_SPILL:
+            overflowQue_.push_back(task);
+            overflowSize_++;
+            spilled_.fetch_add(1, std::memory_order_relaxed);
+            return SubmitStatus::SUBMIT_SPILLED;
+        default:
+            return SubmitStatus::SUBMIT_QUEUE_FULL;
+        }
+    }
+    
+    // 如果有空余，把任务放入任务队列中
+    taskQue_.push(task);
+    taskSize_++;  //submitTask()所在的线程是用户线程，而线程函数所在的线程是另外的线程，因此需要用atomic保证线程安全
+
+    // 因为新放了任务，任务队列不空了，在not_empty_上通知赶快分配线程执行任务
+    // 一个任务只需要一个线程，只唤醒一个正在等待的线程，避免所有空闲线程被唤醒后再争抢taskQueMtx_
+    if (waitingThreadSize_ > 0)
+    {
+        notEmpty_.notify_one();
+    }
+    lock.unlock();
+
+    // 被挤出的任务在释放锁之后再通知，丢弃时可能执行then()的回调并提交新任务
+    if (victim != nullptr)
+    {
+        dropTask(victim);
+    }
+
+    // MODE_CACHED模式：需要根据任务数量和空闲线程数量，判断是否需要创建新的线程
+    // cached模式：场景小而快的任务；fixed模式：比较耗时的任务
+    // 线程由弹性控制线程创建，提交线程不承担创建线程的开销
+    requestGrowth();
+    return SubmitStatus::SUBMIT_OK;
+}
+
+// 指定了NUMA节点的任务入队：和共享任务队列一样受任务队列阈值、分道阈值和溢出策略限制
+SubmitStatus ThreadPool::pushNodeTask(const std::shared_ptr<TaskBase>& task, const std::vector<int>& workers,
+    OverflowPolicy policy, std::chrono::steady_clock::time_point deadline)
+{
+    static thread_local unsigned int nodeSeed = 1;
+    nodeSeed = nodeSeed * 1103515245u + 12345u;
+    WorkStealingQueue& que = *workQues_[workers[(nodeSeed >> 16) % workers.size()]];
+
+    std::unique_lock<std::mutex> lock(taskQueMtx_);
+    std::shared_ptr<TaskBase> victim;
+    if (!canAdmitNode(task->priority_))
+    {
+        switch (policy)
+        {
+        case OverflowPolicy::OVERFLOW_BLOCK:
+        {
+            auto blockStart = std::chrono::steady_clock::now();
+            waitingSubmitSize_++;
+            waitingNodeSubmitSize_++;
+            bool ready = notFull_.wait_until(lock, deadline,
+                [&]()->bool {return canAdmitNode(task->priority_) || (isShutdown_ && localPool_ != this);});
+            waitingNodeSubmitSize_--;
+            waitingSubmitSize_--;
+            submitBlockedNs_.fetch_add(elapsedNs(blockStart), std::memory_order_relaxed);
+            if (!ready || !canAdmitNode(task->priority_))
+            {
+                return ready ? SubmitStatus::SUBMIT_SHUTDOWN : SubmitStatus::SUBMIT_TIMEOUT;
+            }
+            break;
+        }
+        case OverflowPolicy::OVERFLOW_CALLER_RUNS:
+            return SubmitStatus::SUBMIT_CALLER_RAN;
+        case OverflowPolicy::OVERFLOW_DROP_OLDEST:
+            // 挤掉选中线程的私有队列中等待最久的任务，这个队列为空时按队列满处理
+            if (!que.steal(victim))
+            {
+                return SubmitStatus::SUBMIT_QUEUE_FULL;
+            }
+            taskSize_--;
+            break;
+        case OverflowPolicy::OVERFLOW_SPILL:
+            // 放入溢出队列，之后和其他溢出的任务一样移回共享任务队列，不再限定节点
+            overflowQue_.push_back(task);
+            overflowSize_++;
+            spilled_.fetch_add(1, std::memory_order_relaxed);
+            drainOverflow();
+            return SubmitStatus::SUBMIT_SPILLED;
+        default:
+            return SubmitStatus::SUBMIT_QUEUE_FULL;
+        }
+    }
+
+    // 先增加计数再入队，保证其他线程看到队列中的任务时taskSize_不会下溢
+    taskSize_++;
+    que.push(task);
+    if (waitingThreadSize_ > 0)
+    {
+        notEmpty_.notify_one();
+    }
+    lock.unlock();
+
+    if (victim != nullptr)
+    {
+        dropTask(victim);
+    }
+    return SubmitStatus::SUBMIT_OK;
+}
+
+// 指定了NUMA节点的任务能否入队，调用时需持有taskQueMtx_
+// 线程私有队列没有容量限制，按所有队列中排队的任务总数计算任务队列阈值；分道阈值和共享任务队列共用
+bool ThreadPool::canAdmitNode(TaskPriority priority) const
+{
+    int laneMax = laneMaxThreshold_[static_cast<int>(priority)];
+    return taskSize_ < static_cast<unsigned int>(taskQueMaxThreshold_)
+        && (laneMax <= 0 || taskQue_.size(priority) < (size_t)laneMax);
+}
+
+// 线程私有队列出队后通知等待的提交线程：等待指定NUMA节点的任务入队的线程按任务总数判断，没有等待的线程时不加锁
+void ThreadPool::notifySubmitters()
+{
+    if (waitingSubmitSize_ > 0)
+    {
+        std::lock_guard<std::mutex> lock(taskQueMtx_);
+        notFull_.notify_all();
+    }
+}
+
+// OVERFLOW_DROP_OLDEST：丢弃从任务队列挤出的任务
+void ThreadPool::dropTask(const std::shared_ptr<TaskBase>& task)
+{
+    // 已经被等待的线程直接执行过的任务只是队列中残留的记录，挤掉它不影响任何人
+    if (task->runState_.exchange(TaskBase::TASK_CLAIMED, std::memory_order_acq_rel) == TaskBase::TASK_CLAIMED)
+    {
+        return;
+    }
+    discardTask(task, SubmitStatus::SUBMIT_DROPPED);
+}
+
+// 已经取得执行权但不再执行的任务：记录状态并通知等待结果的线程
+void ThreadPool::discardTask(const std::shared_ptr<TaskBase>& task, SubmitStatus status)
+{
+    task->submitStatus_.store(status, std::memory_order_release);
+    switch (status)
+    {
+    case SubmitStatus::SUBMIT_DROPPED: dropped_.fetch_add(1, std::memory_order_relaxed); break;
+    case SubmitStatus::SUBMIT_CANCELED: canceled_.fetch_add(1, std::memory_order_relaxed); break;
+    case SubmitStatus::SUBMIT_EXPIRED: expired_.fetch_add(1, std::memory_order_relaxed); break;
+    default: break;
+    }
+    task->discard();
+    if (task->batch_ != nullptr)
+    {
+        task->batch_->finish();
+    }
+}
+
+// 标记取消，任务还在队列中时立即取得执行权并通知等待的线程
+bool ThreadPool::cancelTask(const std::shared_ptr<TaskBase>& task)
+{
+    task->canceled_.store(true, std::memory_order_release);
+    // 在任务队列中，或者在时间轮中等待到期(时间轮中的记录到期时发现已经被取得执行权就丢弃)
+    int expected = TaskBase::TASK_QUEUED;
+    if (!task->runState_.compare_exchange_strong(expected, TaskBase::TASK_CLAIMED, std::memory_order_acq_rel)
+        && (expected != TaskBase::TASK_DELAYED
+            || !task->runState_.compare_exchange_strong(expected, TaskBase::TASK_CLAIMED, std::memory_order_acq_rel)))
+    {
+        // 已经开始执行、已经执行完，或者没有提交成功
+        return false;
+    }
+    discardTask(task, SubmitStatus::SUBMIT_CANCELED);
+    return true;
+}
+
+// OVERFLOW_SPILL：把溢出队列中的任务按顺序移回任务队列，调用时需持有taskQueMtx_
+void ThreadPool::drainOverflow()
+{
+    size_t moved = 0;
+    while (!overflowQue_.empty())
+    {
+        std::shared_ptr<TaskBase>& task = overflowQue_.front();
+        if (lockFreeQue_ != nullptr)
+        {
+            taskSize_++;
+            if (!lockFreeQue_->push(task))
+            {
+                taskSize_--;
+                break;
+            }
+        }
+        else
+        {
+            if (!canAdmit(task->priority_)) break;
+            taskQue_.push(std::move(task));
+            taskSize_++;
+        }
+        overflowQue_.pop_front();
+        overflowSize_--;
+        moved++;
+    }
+    if (moved > 0 && waitingThreadSize_ > 0)
+    {
+        notifyWaiting(moved);
+    }
+}
+
+// 把一批任务放入任务队列
+BatchResult ThreadPool::enqueueBatch(std::vector<std::shared_ptr<TaskBase>>& tasks, TaskPriority priority)
+{
+    size_t total = tasks.size();
+    auto batch = makeTask<BatchState>(total);
+    auto now = std::chrono::steady_clock::now();
+    // 入队之前绑定批次，任务可能在入队后马上被执行
+    for (auto& task : tasks)
+    {
+        task->batch_ = batch;
+        task->priority_ = priority;
+        task->enqueueTime_ = now;
+        task->runState_.store(TaskBase::TASK_QUEUED, std::memory_order_relaxed);
+#ifdef THREADPOOL_PROFILE
+        task->traceId_ = TaskTrace::enabled() ? TaskTrace::nextId() : 0;
+        if (task->traceId_ != 0) TaskTrace::record(TraceEventType::TRACE_SUBMIT, this, task->traceId_);
+#endif
+    }
+
+    size_t accepted = 0;
+    if (isShutdown_ && localPool_ != this)
+    {
+        // 线程池已经关闭，全部任务按提交失败处理
+    }
+    else if (localPool_ == this && localQue_ != nullptr)
+    {
+        // MODE_STEALING：线程池内的线程提交的任务全部放入自己的队列
+        taskSize_ += static_cast<unsigned int>(total);
+        for (auto& task : tasks)
+        {
+            localQue_->push(task);
+        }
+        accepted = total;
+        if (waitingThreadSize_ > 0)
+        {
+            std::lock_guard<std::mutex> lock(taskQueMtx_);
+            notifyWaiting(total);
+        }
+    }
+    else if (lockFreeQue_ != nullptr)
+    {
+        // QUE_LOCKFREE：逐个无锁入队，全部入队后统一唤醒一次
+        auto deadline = std::chrono::steady_clock::now() + submitTimeout_;
+        while (accepted < total
+            && pushLockFree(tasks[accepted], OverflowPolicy::OVERFLOW_BLOCK, deadline) == SubmitStatus::SUBMIT_OK)
+        {
+            accepted++;
+        }
+        std::lock_guard<std::mutex> lock(taskQueMtx_);
+        notifyWaiting(accepted);
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        auto deadline = std::chrono::steady_clock::now() + submitTimeout_;
+        while (accepted < total)
+        {
+            // 任务队列满时等待空余，和OVERFLOW_BLOCK一样最长阻塞submitTimeout_
+            if (!canAdmit(priority))
+            {
+                auto blockStart = std::chrono::steady_clock::now();
+                waitingSubmitSize_++;
+                bool ready = notFull_.wait_until(lock, deadline,
+                    [&]()->bool {return canAdmit(priority) || (isShutdown_ && localPool_ != this);});
+                waitingSubmitSize_--;
+                submitBlockedNs_.fetch_add(elapsedNs(blockStart), std::memory_order_relaxed);
+                if (!ready || !canAdmit(priority))
+                {
+                    break;
+                }
+            }
+            // 一次放入尽可能多的任务，只唤醒和放入任务数量相同的线程
+            size_t count = 0;
+            while (accepted < total && canAdmit(priority))
+            {
+                taskQue_.push(tasks[accepted++]);
+                count++;
+            }
+            taskSize_ += static_cast<unsigned int>(count);
+            notifyWaiting(count);
+        }
+    }
+    requestGrowth();
+
+    submitted_.fetch_add(accepted, std::memory_order_relaxed);
+    if (accepted < total)
+    {
+        rejected_.fetch_add(total - accepted, std::memory_order_relaxed);
+        std::cerr << (isShutdown_ ? "thread pool is shut down" : "task queue is full")
+            << ", submit " << (total - accepted) << " tasks fail." << std::endl;
+        for (size_t i = accepted; i < total; i++)
+        {
+            tasks[i]->runState_.store(TaskBase::TASK_CREATED, std::memory_order_relaxed);
+            tasks[i]->batch_.reset();
+        }
+        batch->finish(total - accepted);
+    }
+    return BatchResult(batch, accepted, this);
+}
+
+// QUE_LOCKED：某个优先级的任务能否入队，调用时需持有taskQueMtx_
+bool ThreadPool::canAdmit(TaskPriority priority) const
+{
+    int laneMax = laneMaxThreshold_[static_cast<int>(priority)];
+    return taskQue_.size() < (size_t)taskQueMaxThreshold_
+        && (laneMax <= 0 || taskQue_.size(priority) < (size_t)laneMax);
+}
+
+// 唤醒最多n个在notEmpty_上等待的线程，调用时需持有taskQueMtx_
+void ThreadPool::notifyWaiting(size_t n)
+{
+    size_t waiting = static_cast<size_t>(std::max(0, waitingThreadSize_.load()));
+    if (n >= waiting)
+    {
+        notEmpty_.notify_all();
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        notEmpty_.notify_one();
+    }
+}
+
+// 线程池线程执行一个从队列取出的任务
+void ThreadPool::runTask(const std::shared_ptr<TaskBase>& task)
+{
+    if (task->runState_.exchange(TaskBase::TASK_CLAIMED, std::memory_order_acq_rel) == TaskBase::TASK_CLAIMED)
+    {
+        return;
+    }
+    TP_EVENT(TRACE_DEQUEUE, this, task->traceId_);
+    executeTask(task);
+}
+
+// 任务还在任务队列中没有被执行时，取得执行权在当前线程执行
+void ThreadPool::runInline(const std::shared_ptr<TaskBase>& task)
+{
+    int expected = TaskBase::TASK_QUEUED;
+    if (task->runState_.compare_exchange_strong(expected, TaskBase::TASK_CLAIMED, std::memory_order_acq_rel))
+    {
+        executeTask(task);
+    }
+}
+
+// 执行任务并记录统计信息
+void ThreadPool::executeTask(const std::shared_ptr<TaskBase>& task)
+{
+    // 取出时已经被CancelToken取消或超过截止时间的任务不再执行，只通知等待结果的线程
+    SubmitStatus expired = expiredStatus(*task);
+    if (expired != SubmitStatus::SUBMIT_OK)
+    {
+        discardTask(task, expired);
+        return;
+    }
+    auto startTime = std::chrono::steady_clock::now();
+    // 线程池以外的线程(例如等待结果时帮忙执行任务)使用共享的槽位
+    WorkerStats* stats = (localPool_ == this && localStats_ != nullptr) ? localStats_ : &externalStats_;
+    // MODE_CACHED：在自己的计数槽位中记录排队时间，供弹性控制线程判断是否扩容
+    if (poolMode_ == PoolMode::MODE_CACHED)
+    {
+        uint64_t waitNs = elapsedNs(task->enqueueTime_, startTime);
+        uint64_t maxWait = stats->maxWaitNs_.load(std::memory_order_relaxed);
+        while (waitNs > maxWait
+            && !stats->maxWaitNs_.compare_exchange_weak(maxWait, waitNs, std::memory_order_relaxed))
+        {
+        }
+        stats->lastDequeueNs_.store(startTime.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+    // 执行任务并把任务的返回值通过setVal()保存下来，通知Result
+    // 声明为阻塞的任务在阻塞区域中执行，线程池临时增加补偿线程
+    TP_EVENT(TRACE_START, this, task->traceId_);
+    if (task->blocking_)
+    {
+        BlockingRegion blocking;
+        task->exec();
+    }
+    else
+    {
+        task->exec();
+    }
+    TP_EVENT(TRACE_END, this, task->traceId_);
+    stats->record(elapsedNs(task->enqueueTime_, startTime), elapsedNs(startTime));
+    // 批量提交的任务：递减所属批次的计数
+    if (task->batch_ != nullptr)
+    {
+        task->batch_->finish();
+    }
+}
+
+// cached模式下创建一个新线程，调用时需持有taskQueMtx_
+void ThreadPool::addThread(bool reserve)
+{
+    TP_TRACE(">>> create new threads ...", threadSizeThreshold_);
+    // 创建新线程
+    auto ptr = std::make_unique<Thread>(reserve
+        ? Thread::ThreadFunc(std::bind(&ThreadPool::reserveFunc, this, std::placeholders::_1))
+        : Thread::ThreadFunc(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1)));
+    int threadId = ptr->getId();
+    assignAffinity(*ptr, static_cast<int>(threads_.size()));
+    ptr->setStackSize(threadStackSize_);
+    threads_.emplace(threadId, std::move(ptr));
+    // 启动线程
+    threads_[threadId]->start(); 
+    // 修改线程个数相关的变量：保留线程在被唤醒之前不计入当前线程数
+    (reserve ? reserveThreadSize_ : curThreadSize_)++;
+    threadSpawns_.fetch_add(1, std::memory_order_relaxed);
+    TP_EVENT(TRACE_SPAWN, this, threadId);
+}
+
+// cached模式下扩容一个线程，优先唤醒保留线程池中休眠的线程
+void ThreadPool::activateThread()
+{
+    if (reserveThreadSize_ - activatePending_ <= 0)
+    {
+        addThread();
+        return;
+    }
+    // 被唤醒的线程醒来之前就计入当前线程数，控制线程下一次检查时不会重复扩容
+    activatePending_++;
+    curThreadSize_++;
+    threadActivations_.fetch_add(1, std::memory_order_relaxed);
+    TP_EVENT(TRACE_ACTIVATE, this, 0);
+    reserveCond_.notify_one();
+}
+
+// 当前线程进入阻塞区域，可以执行任务的线程少了一个时补偿一个线程
+void ThreadPool::beginBlocking()
+{
+    std::lock_guard<std::mutex> lock(taskQueMtx_);
+    blockingThreadSize_++;
+    if (!isPoolRunning_ || compensation_ >= blockingThreadSize_) return;
+    // 之前的阻塞区域结束、还没有退出的多余线程直接留下来，不需要再增加线程
+    if (retirePending_ > 0)
+    {
+        retirePending_--;
+        compensation_++;
+        return;
+    }
+    if (curThreadSize_ >= static_cast<int>(threadSizeThreshold_)) return;
+    compensation_++;
+    compensations_.fetch_add(1, std::memory_order_relaxed);
+    TP_EVENT(TRACE_COMPENSATE, this, 0);
+    // MODE_CACHED下优先唤醒保留线程，其他模式下直接创建线程
+    activateThread();
+}
+
+// 当前线程离开阻塞区域，多出的补偿线程退出
+void ThreadPool::endBlocking()
+{
+    std::lock_guard<std::mutex> lock(taskQueMtx_);
+    blockingThreadSize_--;
+    if (compensation_ > blockingThreadSize_)
+    {
+        compensation_--;
+        retirePending_++;
+        // 空闲的线程醒来后退出，没有空闲线程时下一个空闲的线程退出
+        notEmpty_.notify_all();
+    }
+}
+
+// 在保留线程池中休眠
+bool ThreadPool::parkThread(std::unique_lock<std::mutex>& lock)
+{
+    // 保留线程在单独的条件变量上等待，notEmpty_的通知不会唤醒它们
+    TP_EVENT(TRACE_PARK, this, 0);
+    reserveCond_.wait(lock, [&]()->bool { return activatePending_ > 0 || !isPoolRunning_; });
+    reserveThreadSize_--;
+    if (activatePending_ > 0)
+    {
+        activatePending_--;
+        return true;
+    }
+    return false;
+}
+
+// 预先创建的保留线程的线程函数
+void ThreadPool::reserveFunc(int threadId)
+{
+    {
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        if (!parkThread(lock))
+        {
+            // 一直没有被唤醒，线程池就关闭了
+            retireThread(threadId);
+            exitCond_.notify_all();
+            return;
+        }
+    }
+    threadFunc(threadId);
+}
+
+// MODE_CACHED：有任务积压时唤醒休眠中的弹性控制线程
+void ThreadPool::requestGrowth()
+{
+    if (poolMode_ != PoolMode::MODE_CACHED
+        || !controllerParked_.load(std::memory_order_relaxed)
+        || taskSize_ <= static_cast<unsigned int>(std::max(waitingThreadSize_.load(), 0)))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(ctrlMtx_);
+    controllerParked_ = false;
+    ctrlCond_.notify_one();
+}
+
+// 弹性控制线程函数
+// 排队延迟估计：上次检查以来开始执行的任务的最长排队时间；所有线程都在忙时，队头任务至少已经等待了
+// “从积压开始或最近一次有任务开始执行到现在”的时间，即使一直没有任务被取出也能发现延迟在增加
+void ThreadPool::controllerFunc()
+{
+    int overTicks = 0; // 连续超过延迟目标的检查次数
+    int64_t backlogSince = 0; // 本次积压开始的时间，0表示没有积压
+    int minIdle = INT_MAX; // 本次观察窗口内空闲线程数的最小值
+    int64_t windowStart = steadyNowNs(); // 回收观察窗口的开始时间
+
+    std::unique_lock<std::mutex> lock(ctrlMtx_);
+    while (controllerRunning_)
+    {
+        ElasticPolicy policy = elasticPolicy_;
+        // 没有积压时按较长周期休眠，只需要按时完成空闲回收的判断，有积压时由提交线程提前唤醒
+        bool backlog = taskSize_ > 0;
+        auto interval = policy.checkInterval;
+        if (!backlog)
+        {
+            auto parked = std::chrono::duration_cast<std::chrono::microseconds>(policy.idleTimeout) / 10;
+            interval = std::max(policy.checkInterval, std::min(parked, std::chrono::microseconds(100000)));
+            controllerParked_ = true;
+        }
+        ctrlCond_.wait_for(lock, interval);
+        controllerParked_ = false;
+        if (!controllerRunning_) break;
+        lock.unlock();
+
+        // 回收的线程已经退出，在这里join()
+        joinExited();
+
+        // 没有积压、也没有多余的线程可以回收进保留线程池时补足保留线程池，创建系统线程的开销不落在下一次扩容上
+        if (taskSize_ == 0 && curThreadSize_ <= static_cast<int>(initThreadSize_))
+        {
+            std::lock_guard<std::mutex> queLock(taskQueMtx_);
+            reserveLimit_ = policy.reserveThreads;
+            while (reserveThreadSize_ < reserveLimit_)
+            {
+                addThread(true);
+            }
+        }
+
+        int64_t now = steadyNowNs();
+        int idle = idleThreads();
+        int cur = curThreadSize_;
+        // 汇总各线程记录的排队时间
+        uint64_t waitNs = 0;
+        int64_t lastDequeueNs = 0;
+        {
+            std::lock_guard<std::mutex> statsLock(statsMtx_);
+            auto collect = [&](WorkerStats& stats) {
+                waitNs = std::max(waitNs, stats.maxWaitNs_.exchange(0, std::memory_order_relaxed));
+                lastDequeueNs = std::max(lastDequeueNs, stats.lastDequeueNs_.load(std::memory_order_relaxed));
+            };
+            for (auto& stats : workerStats_)
+            {
+                collect(*stats);
+            }
+            collect(externalStats_);
+        }
+        if (taskSize_ > 0 && idle <= 0)
+        {
+            if (backlogSince == 0) backlogSince = now;
+            int64_t since = std::max(backlogSince, lastDequeueNs);
+            waitNs = std::max(waitNs, static_cast<uint64_t>(std::max<int64_t>(now - since, 0)));
+        }
+        else
+        {
+            backlogSince = 0;
+        }
+        uint64_t targetNs = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(policy.targetLatency).count());
+
+        // 扩容：连续growAfterTicks次超过延迟目标
+        overTicks = waitNs > targetNs ? overTicks + 1 : 0;
+        if (overTicks >= policy.growAfterTicks)
+        {
+            overTicks = 0;
+            std::lock_guard<std::mutex> queLock(taskQueMtx_);
+            reapPending_ = 0; // 负载又上来了，取消还没有执行的回收请求
+            int backlogSize = static_cast<int>(taskSize_) - idleThreads();
+            int grow = std::min({ policy.maxGrowStep, std::max(backlogSize, 1),
+                static_cast<int>(threadSizeThreshold_) - curThreadSize_.load() });
+            for (int i = 0; i < grow; i++)
+            {
+                activateThread();
+            }
+            minIdle = INT_MAX;
+            windowStart = now;
+        }
+
+        // 回收：窗口内延迟都低于目标的一半，窗口结束时回收窗口内始终空闲的线程
+        if (waitNs * 2 > targetNs)
+        {
+            minIdle = INT_MAX;
+            windowStart = now;
+        }
+        else
+        {
+            minIdle = std::min(minIdle, idle);
+            int64_t timeoutNs = std::chrono::duration_cast<std::chrono::nanoseconds>(policy.idleTimeout).count();
+            if (now - windowStart >= timeoutNs)
+            {
+                std::lock_guard<std::mutex> queLock(taskQueMtx_);
+                int surplus = std::min(minIdle - reapPending_, cur - static_cast<int>(initThreadSize_) - reapPending_);
+                if (surplus > 0)
+                {
+                    reapPending_ += surplus;
+                    notEmpty_.notify_all();
+                }
+                minIdle = INT_MAX;
+                windowStart = now;
+            }
+        }
+        lock.lock();
+    }
+}
+
+// 线程启动时取得一个统计计数槽位
+WorkerStats* ThreadPool::acquireStats()
+{
+    std::lock_guard<std::mutex> lock(statsMtx_);
+    if (!freeStats_.empty())
+    {
+        WorkerStats* stats = freeStats_.back();
+        freeStats_.pop_back();
+        return stats;
+    }
+    workerStats_.emplace_back(std::make_unique<WorkerStats>());
+    return workerStats_.back().get();
+}
+
+// 线程退出时归还统计计数槽位，已经累计的计数保留
+void ThreadPool::releaseStats(WorkerStats* stats)
+{
+    std::lock_guard<std::mutex> lock(statsMtx_);
+    freeStats_.push_back(stats);
+}
+
+// 空闲线程数：各线程只修改自己槽位中的busy_，读取时汇总，执行任务时不修改共享的计数
+int ThreadPool::idleThreads() const
+{
+    int busy = 0;
+    {
+        std::lock_guard<std::mutex> lock(statsMtx_);
+        for (auto& stats : workerStats_)
+        {
+            busy += stats->busy_.load(std::memory_order_relaxed);
+        }
+    }
+    return std::max(curThreadSize_.load(std::memory_order_relaxed) - busy, 0);
+}
+
+// 获取线程池统计信息快照
+PoolStats ThreadPool::stats() const
+{
+    PoolStats result;
+    result.submitted = submitted_.load(std::memory_order_relaxed);
+    result.rejected = rejected_.load(std::memory_order_relaxed);
+    result.submitBlockedNs = submitBlockedNs_.load(std::memory_order_relaxed);
+    result.threadSpawns = threadSpawns_.load(std::memory_order_relaxed);
+    result.threadReaps = threadReaps_.load(std::memory_order_relaxed);
+    result.threadActivations = threadActivations_.load(std::memory_order_relaxed);
+    result.compensations = compensations_.load(std::memory_order_relaxed);
+    result.blockingThreads = blockingThreadSize_.load(std::memory_order_relaxed);
+    result.callerRuns = callerRuns_.load(std::memory_order_relaxed);
+    result.dropped = dropped_.load(std::memory_order_relaxed);
+    result.spilled = spilled_.load(std::memory_order_relaxed);
+    result.canceled = canceled_.load(std::memory_order_relaxed);
+    result.expired = expired_.load(std::memory_order_relaxed);
+    result.overflowDepth = overflowSize_.load(std::memory_order_relaxed);
+    result.queueDepth = taskSize_.load(std::memory_order_relaxed);
+    result.curThreads = curThreadSize_.load(std::memory_order_relaxed);
+    result.reserveThreads = reserveThreadSize_.load(std::memory_order_relaxed);
+
+    auto add = [&](const WorkerStats& stats) {
+        result.completed += stats.completed_.load(std::memory_order_relaxed);
+        result.steals += stats.steals_.load(std::memory_order_relaxed);
+        for (int i = 0; i < LATENCY_BUCKET_SIZE; i++)
+        {
+            result.waitTime.buckets_[i] += stats.waitTime_[i].load(std::memory_order_relaxed);
+            result.runTime.buckets_[i] += stats.runTime_[i].load(std::memory_order_relaxed);
+        }
+    };
+    int busy = 0;
+    std::lock_guard<std::mutex> lock(statsMtx_);
+    for (auto& stats : workerStats_)
+    {
+        add(*stats);
+        busy += stats->busy_.load(std::memory_order_relaxed);
+    }
+    add(externalStats_);
+    result.idleThreads = std::max(result.curThreads - busy, 0);
+    return result;
+}
+
+// 无锁任务队列入队，队列满时按policy处理
+SubmitStatus ThreadPool::pushLockFree(const std::shared_ptr<TaskBase>& task, OverflowPolicy policy,
+    std::chrono::steady_clock::time_point deadline)
+{
+    // 入队成功会移走item，task还要留给Result使用
+    std::shared_ptr<TaskBase> item = task;
+    // OVERFLOW_SPILL：溢出队列中还有任务时新任务排在后面，保持提交顺序
+    if (policy != OverflowPolicy::OVERFLOW_SPILL || overflowSize_.load() == 0)
+    {
+        // 先增加计数再入队，保证出队后taskSize_--不会下溢
+        taskSize_++;
+        if (lockFreeQue_->push(item)) return SubmitStatus::SUBMIT_OK;
+        taskSize_--;
+    }
+
+    switch (policy)
+    {
+    case OverflowPolicy::OVERFLOW_CALLER_RUNS:
+        return SubmitStatus::SUBMIT_CALLER_RAN;
+    case OverflowPolicy::OVERFLOW_DROP_OLDEST:
+        // 环形队列按FIFO出队，队头就是等待最久的任务，挤掉它再重试；其他线程同时出队时直接重试
+        for (;;)
+        {
+            std::shared_ptr<TaskBase> victim;
+            if (lockFreeQue_->pop(victim))
+            {
+                taskSize_--;
+                dropTask(victim);
+            }
+            taskSize_++;
+            if (lockFreeQue_->push(item)) return SubmitStatus::SUBMIT_OK;
+            taskSize_--;
+        }
+    case OverflowPolicy::OVERFLOW_SPILL:
+    {
+        std::lock_guard<std::mutex> lock(taskQueMtx_);
+        overflowQue_.push_back(item);
+        overflowSize_++;
+        spilled_.fetch_add(1, std::memory_order_relaxed);
+        // 消费者在登记之前出队时看不到溢出队列中的任务，登记之后自己再移回一次，不会有任务一直留在溢出队列
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        drainOverflow();
+        return SubmitStatus::SUBMIT_SPILLED;
+    }
+    case OverflowPolicy::OVERFLOW_BLOCK:
+        break;
+    default:
+        return SubmitStatus::SUBMIT_QUEUE_FULL;
+    }
+
+    // 环形队列已满，退化为在notFull_上等待消费者出队
+    auto blockStart = std::chrono::steady_clock::now();
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(taskQueMtx_);
+            // 批量提交时还没有唤醒消费者，先唤醒再等待，否则双方会互相等待
+            if (waitingThreadSize_ > 0)
+            {
+                notEmpty_.notify_all();
+            }
+            // 先登记等待再检查条件，和消费者“先出队再检查waitingSubmitSize_”配合，不会丢失通知
+            waitingSubmitSize_++;
+            bool ready = notFull_.wait_until(lock, deadline,
+                [&]()->bool { return taskSize_ < lockFreeQue_->capacity() || (isShutdown_ && localPool_ != this); });
+            waitingSubmitSize_--;
+            if (!ready || (isShutdown_ && localPool_ != this))
+            {
+                submitBlockedNs_.fetch_add(elapsedNs(blockStart), std::memory_order_relaxed);
+                return ready ? SubmitStatus::SUBMIT_SHUTDOWN : SubmitStatus::SUBMIT_TIMEOUT;
+            }
+        }
+        taskSize_++;
+        if (lockFreeQue_->push(item))
+        {
+            submitBlockedNs_.fetch_add(elapsedNs(blockStart), std::memory_order_relaxed);
+            return SubmitStatus::SUBMIT_OK;
+        }
+        taskSize_--;
+    }
+}
+
+// 按绑核策略开启线程池
+void ThreadPool::start(int initThreadSize, const AffinityPolicy& policy)
+{
+    setAffinity(policy);
+    start(initThreadSize);
+}
+
+// 设置线程绑核策略
+void ThreadPool::setAffinity(const AffinityPolicy& policy)
+{
+    if (checkRunningState()) return;
+    affinityPolicy_ = policy;
+}
+
+// NUMA节点数量
+int ThreadPool::numaNodeCount() const
+{
+    return static_cast<int>(topology_.nodes_.size());
+}
+
+// 开启线程池
+void ThreadPool::start(int initThreadSize)
+{
+    // 设置线程池运行状态
+    isPoolRunning_ = true;
+
+    // QUE_LOCKFREE：按任务队列最大阈值创建环形队列
+    if (taskQueMode_ == TaskQueMode::QUE_LOCKFREE)
+    {
+        lockFreeQue_ = std::make_unique<MpmcRingQueue<std::shared_ptr<TaskBase>>>(taskQueMaxThreshold_);
+    }
+
+    // 读取CPU拓扑，用于绑核和按NUMA节点提交任务
+    topology_ = CpuTopology::detect();
+    nodeWorkers_.assign(topology_.nodes_.size(), std::vector<int>());
+
+    // 记录初始线程个数
+    initThreadSize_ = initThreadSize;
+    curThreadSize_ = initThreadSize;
+
+    // 创建线程对象
+    for (int i = 0; i < initThreadSize_; i++)
+    {
+        // 创建thread线程对象的时候，把当前线程池对象的线程函数给到thread线程对象
+        auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
+        int threadId = ptr->getId();
+        int node = assignAffinity(*ptr, i);
+        ptr->setStackSize(threadStackSize_);
+        threads_.emplace(threadId, std::move(ptr)); // unique_ptr禁止左值引用的拷贝和赋值，但可以右值引用
+
+        // MODE_STEALING：为每个线程创建私有任务队列
+        if (poolMode_ == PoolMode::MODE_STEALING)
+        {
+            workerIndex_.emplace(threadId, i);
+            workQues_.emplace_back(std::make_unique<WorkStealingQueue>());
+            if (node >= 0)
+            {
+                nodeWorkers_[node].push_back(i);
+            }
+        }
+    }
+    // 启动所有线程
+    // 线程id由所有线程池共享的generatedId_生成，不一定从0开始，因此遍历threads_而不是按下标访问
+    // 持有taskQueMtx_启动，已经开始执行的阻塞任务补偿线程时不会和这里同时修改threads_
+    {
+        std::lock_guard<std::mutex> queLock(taskQueMtx_);
+        for (auto& item : threads_)
+        {
+            item.second->start(); // 去执行一个线程函数
+        }
+    }
+
+    // MODE_CACHED：预先创建保留线程，再启动弹性控制线程，由它创建和回收initThreadSize_以外的线程
+    if (poolMode_ == PoolMode::MODE_CACHED)
+    {
+        {
+            std::lock_guard<std::mutex> queLock(taskQueMtx_);
+            reserveLimit_ = elasticPolicy_.reserveThreads;
+            while (reserveThreadSize_ < reserveLimit_)
+            {
+                addThread(true);
+            }
+        }
+        controllerRunning_ = true;
+        controller_ = std::thread(&ThreadPool::controllerFunc, this);
+    }
+}
+
+//定义线程函数--线程池里面的线程从任务队列中消费任务
+void ThreadPool::threadFunc(int threadId)
+{
+    // MODE_STEALING：记录当前线程的私有任务队列
+    // 阻塞补偿创建的线程没有私有队列，只从其他线程的队列窃取
+    int workerIndex = -1;
+    if (poolMode_ == PoolMode::MODE_STEALING)
+    {
+        auto it = workerIndex_.find(threadId);
+        if (it != workerIndex_.end())
+        {
+            workerIndex = it->second;
+            localIndex_ = workerIndex;
+            localQue_ = workQues_[workerIndex].get();
+        }
+        stealSeed_ = static_cast<unsigned int>(threadId) * 2654435761u + 1;
+    }
+    localPool_ = this;
+    localStats_ = acquireStats();
+    // 当前线程的自旋次数，自适应策略下随任务到达情况变化
+    int spinLimit = idlePolicy_.spinCount;
+
+    // 等所有任务必须执行完成，线程池才可以回收所有线程资源：for (;;)
+    // 原本：while (isPoolRunning_)
+    for (;;) // 死循环
+    {
+        std::shared_ptr<TaskBase> task;
+        // 跟踪信息不能在持有taskQueMtx_时输出，否则所有线程都会在输出流的锁上串行
+        TP_TRACE("尝试获取任务...", threadId);
+        // 先尝试不加taskQueMtx_获取任务，再自旋等待一会，都取不到再加锁等待
+        if (tryAcquireTask(workerIndex, task) || spinForTask(workerIndex, task, spinLimit))
+        {
+            localStats_->busy_.store(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            // 获取锁
+            std::unique_lock<std::mutex> lock(taskQueMtx_);
+
+            // MODE_CACHED：有可能已经创建了很多线程，空闲一段时间后应该把多余线程结束回收
+            // 超过initThreadSize_数量的线程要进行回收，由弹性控制线程判断回收哪几个(reapPending_)
+
+            // 原本：锁 + 双重判断 ：while (isPoolRunning_ && taskQue_.size() == 0)
+            // 先登记等待再检查taskSize_，和提交线程“先入队再检查waitingThreadSize_”配合，不会丢失通知
+            waitingThreadSize_++;
+            while (taskQue_.size() == 0)
+            {
+                // MODE_STEALING/QUE_LOCKFREE：任务在其他队列中，回到外层循环不加锁获取
+                if ((!workQues_.empty() || lockFreeQue_ != nullptr) && taskSize_ > 0)
+                {
+                    break;
+                }
+
+                // 检查是有任务被唤醒还是线程池结束回收线程资源被唤醒
+                if (!isPoolRunning_)
+                {
+                    waitingThreadSize_--;
+                    releaseStats(localStats_);
+                    retireThread(threadId);
+                    exitCond_.notify_all(); // 唤醒线程池析构函数中的条件变量
+                    TP_TRACE("exit!", threadId);
+                    return; // 线程函数结束，线程结束
+                }
+
+                bool reap = poolMode_ == PoolMode::MODE_CACHED
+                    && reapPending_ > 0
+                    && curThreadSize_ > static_cast<int>(initThreadSize_);
+                // 阻塞区域结束后多出的线程：MODE_STEALING下有私有队列的线程不退出，由补偿线程退出
+                bool retire = retirePending_ > 0 && (workerIndex < 0 || poolMode_ != PoolMode::MODE_STEALING);
+                if (reap || retire)
+                {
+                    // 弹性控制线程判断有多余的空闲线程，或者阻塞的线程已经恢复，回收当前线程
+                    // 记录线程数量的相关变量的值修改
+                    if (retire)
+                    {
+                        retirePending_--;
+                    }
+                    else
+                    {
+                        reapPending_--;
+                        threadReaps_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    waitingThreadSize_--;
+                    curThreadSize_--;
+                    // 保留线程池没有满：不销毁线程，在保留线程池中休眠，扩容时被唤醒后继续等待任务
+                    if (reserveThreadSize_ < reserveLimit_)
+                    {
+                        reserveThreadSize_++;
+                        if (parkThread(lock))
+                        {
+                            waitingThreadSize_++;
+                            continue;
+                        }
+                        // 休眠中线程池关闭了：计数槽位还没有归还，按下面的方式退出
+                    }
+                    // 把线程对象从线程列表容器中删除
+                    // 通过线程id找到线程对象进而删除
+                    TP_EVENT(TRACE_REAP, this, threadId);
+                    releaseStats(localStats_);
+                    retireThread(threadId); // 由弹性控制线程join()
+                    exitCond_.notify_all(); // 线程池可能正在关闭
+                    TP_TRACE("exit!", threadId);
+                    return;
+                }
+                // 等待notEmpty_条件，任务队列size()大于 0 时不等待
+                // MODE_CACHED的空闲回收也由弹性控制线程定时判断后唤醒，不再每秒超时轮询
+                notEmpty_.wait(lock);
+
+                // // 检查是有任务被唤醒还是线程池结束回收线程资源被唤醒
+                // if (!isPoolRunning_)
+                // {
+                //     threads_.erase(threadId);
+                //     exitCond_.notify_all(); // 唤醒线程池析构函数中的条件变量
+                //     std::cout << "threadid : " << std::this_thread::get_id() << " exit!" << std::endl;
+                //     return; // 结束线程函数就是结束当前线程了
+                // }             
+            }
+
+            // // 检查是有任务被唤醒还是线程池结束回收线程资源被唤醒
+            // if (!isPoolRunning_)
+            // {
+            //     break;
+            // }
+
+            waitingThreadSize_--;
+
+            if (taskQue_.empty())
+            {
+                continue;
+            }
+
+            // 线程开始忙了，只修改自己槽位中的标记
+            localStats_->busy_.store(1, std::memory_order_relaxed);
+
+            // 从任务队列中取一个任务出来
+            task = takeSharedTask();
+
+            // 如果本线程取出一个任务后仍然有剩余任务，继续通知一个等待的线程执行任务
+            if (!taskQue_.empty() && waitingThreadSize_ > 0)
+            {
+                notEmpty_.notify_one();
+            }
+        }// 离开作用域释放锁
+
+        // 当前线程负责执行这个任务
+        if (task != nullptr)
+        {
+            TP_TRACE("获取任务成功...", threadId);
+            runTask(task);
+            TP_TRACE("执行任务结束", threadId);
+        }
+        // 已完成任务，线程重新空闲
+        localStats_->busy_.store(0, std::memory_order_relaxed);
+    }
+    // threads_.erase(threadId);
+    // std::cout << "threadid : " << std::this_thread::get_id() << " exit!" << std::endl;
+    // exitCond_.notify_all(); // 唤醒线程池析构函数中的条件变量
+}
+
+// 检查线程池运行状态
+bool ThreadPool::checkRunningState() const
+{
+    return isPoolRunning_;
+}
+
+// 按绑核策略设置第ordinal个线程运行的CPU，返回线程所在的NUMA节点
+int ThreadPool::assignAffinity(Thread& thread, int ordinal)
+{
+    const std::vector<std::vector<int>>& nodes = topology_.nodes_;
+    if (nodes.empty()) return -1;
+
+    switch (affinityPolicy_.mode)
+    {
+    case AffinityMode::AFFINITY_COMPACT:
+    {
+        // 所有节点的CPU按顺序排成一列，依次绑定
+        std::vector<int> cpus;
+        for (auto& node : nodes) cpus.insert(cpus.end(), node.begin(), node.end());
+        int cpu = cpus[ordinal % cpus.size()];
+        thread.setAffinity({ cpu });
+        return topology_.nodeOf(cpu);
+    }
+    case AffinityMode::AFFINITY_SCATTER:
+    {
+        // 轮流选取节点，节点内依次选取CPU
+        int node = ordinal % static_cast<int>(nodes.size());
+        const std::vector<int>& cpus = nodes[node];
+        thread.setAffinity({ cpus[(ordinal / nodes.size()) % cpus.size()] });
+        return node;
+    }
+    case AffinityMode::AFFINITY_CPU_LIST:
+    {
+        if (affinityPolicy_.cpus.empty()) return -1;
+        int cpu = affinityPolicy_.cpus[ordinal % affinityPolicy_.cpus.size()];
+        thread.setAffinity({ cpu });
+        return topology_.nodeOf(cpu);
+    }
+    case AffinityMode::AFFINITY_NUMA:
+    {
+        // 线程按节点平均分组，可以在本节点的所有CPU上运行
+        int node = ordinal % static_cast<int>(nodes.size());
+        thread.setAffinity(nodes[node]);
+        return node;
+    }
+    default:
+        return -1;
+    }
+}
+
+// 工作窃取模式：从随机选取的其他线程的队列队头窃取任务
+bool ThreadPool::stealTask(int workerIndex, std::shared_ptr<TaskBase>& task)
+{
+    int n = static_cast<int>(workQues_.size());
+    if (n <= 1) return false;
+
+    // xorshift随机选取起点，避免所有空闲线程同时窃取同一个线程
+    stealSeed_ ^= stealSeed_ << 13;
+    stealSeed_ ^= stealSeed_ >> 17;
+    stealSeed_ ^= stealSeed_ << 5;
+    int start = static_cast<int>(stealSeed_ % n);
+    for (int i = 0; i < n; i++)
+    {
+        int victim = (start + i) % n;
+        if (victim != workerIndex && workQues_[victim]->steal(task))
+        {
+            TP_EVENT(TRACE_STEAL, this, task->traceId_);
+            return true;
+        }
+    }
+    return false;
+}
+// 空闲自旋：进入条件变量等待前自旋等待新任务，返回是否已经不加锁取到任务
+bool ThreadPool::spinForTask(int workerIndex, std::shared_ptr<TaskBase>& task, int& spinLimit)
+{
+    for (int i = 0; i < spinLimit; i++)
+    {
+        if (taskSize_ > 0 || !isPoolRunning_)
+        {
+            // 自旋期间等到了任务，说明任务到达较频繁，下次多自旋一会
+            if (idlePolicy_.adaptive)
+            {
+                spinLimit = std::min(spinLimit * 2, idlePolicy_.maxSpinCount);
+            }
+            // QUE_LOCKED模式下任务在taskQue_中，返回false由调用者加锁获取
+            return tryAcquireTask(workerIndex, task);
+        }
+        cpuRelax();
+        // 自旋较久时让出CPU，避免线程数多于核心数时饿死持有任务的线程
+        if ((i & 63) == 63)
+        {
+            std::this_thread::yield();
+        }
+    }
+    // 白白自旋了一轮，说明任务到达稀疏，下次少自旋一会
+    if (idlePolicy_.adaptive)
+    {
+        spinLimit = std::max(spinLimit / 2, idlePolicy_.minSpinCount);
+    }
+    return false;
+}
+
+// 持有taskQueMtx_时从共享任务队列取出一个任务，并通知等待的提交线程
+std::shared_ptr<TaskBase> ThreadPool::takeSharedTask()
+{
+    std::shared_ptr<TaskBase> task = taskQue_.pop();
+    taskSize_--;
+    // OVERFLOW_SPILL：腾出的位置先留给溢出队列中的任务
+    if (overflowSize_ > 0)
+    {
+        drainOverflow();
+    }
+    // 腾出了一个位置，通知一个等待的生产者可以继续提交任务
+    // 设置了分道阈值或有等待指定NUMA节点的任务入队的生产者时，等待的生产者条件各不相同，只能全部唤醒各自检查
+    if (waitingSubmitSize_ > 0)
+    {
+        if (laneMaxThreshold_[static_cast<int>(task->priority_)] > 0 || waitingNodeSubmitSize_ > 0)
+            notFull_.notify_all();
+        else
+            notFull_.notify_one();
+    }
+    return task;
+}
+
+// 取出一个其他任务在当前线程执行
+bool ThreadPool::helpOnce()
+{
+    if (!canHelp()) return false;
+
+    std::shared_ptr<TaskBase> task;
+    // 线程池自己的线程先取私有队列，线程池以外的线程没有私有队列，直接从所有线程的队列窃取
+    int workerIndex = localPool_ == this ? localIndex_ : -1;
+    if (!tryAcquireTask(workerIndex, task))
+    {
+        bool stolen = false;
+        if (workerIndex < 0 && workQues_.size() > 0)
+        {
+            if (stealSeed_ == 0)
+            {
+                stealSeed_ = static_cast<unsigned int>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+            }
+            stolen = stealTask(-1, task);
+            if (stolen)
+            {
+                taskSize_--;
+                notifySubmitters();
+            }
+        }
+        // QUE_LOCKFREE的共享队列已经在tryAcquireTask()中取过
+        if (!stolen)
+        {
+            if (lockFreeQue_ != nullptr) return false;
+            std::lock_guard<std::mutex> lock(taskQueMtx_);
+            if (taskQue_.empty()) return false;
+            task = takeSharedTask();
+        }
+    }
+
+    helpDepth_++;
+    runTask(task);
+    helpDepth_--;
+    return true;
+}
+
+// 任务队列中是否还有可以帮忙的任务
+bool ThreadPool::canHelp() const
+{
+    return isPoolRunning_ && helpDepth_ < MAX_HELP_DEPTH && taskSize_ > 0;
+}
+
+// 不加taskQueMtx_尝试获取任务：自己的队列、无锁任务队列、窃取其他线程的队列
+bool ThreadPool::tryAcquireTask(int workerIndex, std::shared_ptr<TaskBase>& task)
+{
+    // MODE_STEALING：先从自己的队列队尾取任务
+    if (workerIndex >= 0 && localQue_->pop(task))
+    {
+        taskSize_--;
+        notifySubmitters();
+        return true;
+    }
+    // QUE_LOCKFREE：从无锁任务队列取任务，有提交线程因队列满而等待时才加锁通知
+    if (lockFreeQue_ != nullptr && lockFreeQue_->pop(task))
+    {
+        taskSize_--;
+        // OVERFLOW_SPILL：出队后再检查溢出队列，和提交线程“先登记溢出任务再重试入队”配合，不会有任务一直留在溢出队列
+        // 定时器到期和co_await schedule()在其他溢出策略下也会放入溢出队列，所以不按线程池的溢出策略跳过
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (overflowSize_ > 0)
+        {
+            std::lock_guard<std::mutex> lock(taskQueMtx_);
+            drainOverflow();
+        }
+        if (waitingSubmitSize_ > 0)
+        {
+            std::lock_guard<std::mutex> lock(taskQueMtx_);
+            if (waitingNodeSubmitSize_ > 0)
+                notFull_.notify_all();
+            else
+                notFull_.notify_one();
+        }
+        return true;
+    }
+    // MODE_STEALING：再去其他线程的队列窃取(阻塞补偿创建的线程没有私有队列，也要窃取)
+    if ((workerIndex >= 0 || (localPool_ == this && localStats_ != nullptr && !workQues_.empty()))
+        && stealTask(workerIndex, task))
+    {
+        taskSize_--;
+        notifySubmitters();
+        localStats_->steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+/*************************阻塞区域类方法实现*************************/
+// 进入阻塞区域：只有线程池线程第一次进入时补偿
+BlockingRegion::BlockingRegion()
+    : pool_(nullptr)
+{
+    if (localPool_ == nullptr || localBlocking_) return;
+    pool_ = localPool_;
+    localBlocking_ = true;
+    pool_->beginBlocking();
+}
+
+// 离开阻塞区域
+BlockingRegion::~BlockingRegion()
+{
+    if (pool_ == nullptr) return;
+    localBlocking_ = false;
+    pool_->endBlocking();
+}
+
+/*************************串行执行器类方法实现*************************/
+// Strand队列节点，从任务内存池分配
+struct StrandNode
+{
+    std::shared_ptr<TaskBase> task;
+    std::atomic<StrandNode*> next{nullptr};
+};
+
+// Strand的共享状态：无锁的多生产者单消费者队列(Vyukov)
+// 生产者交换head_后链接节点；size_从0变为1的生产者取得排空权，直到排空任务把size_减到0
+// 同一时刻只有持有排空权的线程访问tail_，因此同一个Strand上的任务不会并发执行
+class StrandState
+{
+public:
+    explicit StrandState(ThreadPool* pool)
+        : pool_(pool)
+        , size_(0)
+        , head_(&stub_)
+        , tail_(&stub_)
+    {}
+    ~StrandState();
+
+    // 把任务放入队列，取得排空权时提交排空任务
+    static void push(const std::shared_ptr<StrandState>& self, std::shared_ptr<TaskBase> task);
+    // 持有排空权：依次执行队列中的任务
+    static void drain(const std::shared_ptr<StrandState>& self);
+    // 持有排空权但排空任务没有执行(线程池关闭时被shutdown()返回后丢弃)：丢弃队列中的所有任务
+    static void discardAll(const std::shared_ptr<StrandState>& self, SubmitStatus status);
+
+    ThreadPool* pool_;
+    std::atomic<size_t> size_; // 队列中还没有执行完的任务数量
+
+private:
+    // 取出队头任务，只由持有排空权的线程调用
+    std::shared_ptr<TaskBase> pop();
+    // 提交排空任务，提交失败时在当前线程排空
+    static void schedule(const std::shared_ptr<StrandState>& self);
+
+    std::atomic<StrandNode*> head_; // 最后放入的节点，生产者修改
+    StrandNode* tail_; // 已经取出的节点(哑节点)，它的next是队头
+    StrandNode stub_; // 初始的哑节点
+};
+
+// Strand的排空任务：每次取得排空权或重新提交时创建，由任务内存池分配
+class StrandTask : public TaskBase
+{
+public:
+    explicit StrandTask(std::shared_ptr<StrandState> state) : state_(std::move(state)) {}
+    void exec() override { StrandState::drain(state_); }
+    void discard() override { StrandState::discardAll(state_, submitStatus()); }
+
+private:
+    std::shared_ptr<StrandState> state_;
+};
+
+// 释放还没有执行的任务(排空任务被丢弃时)
+StrandState::~StrandState()
+{
+    StrandNode* node = tail_;
+    while (node != nullptr)
+    {
+        StrandNode* next = node->next.load(std::memory_order_relaxed);
+        if (node != &stub_)
+        {
+            node->~StrandNode();
+            TaskMemoryPool::deallocate(node, sizeof(StrandNode));
+        }
+        node = next;
+    }
+}
+
+// 把任务放入队列
+void StrandState::push(const std::shared_ptr<StrandState>& self, std::shared_ptr<TaskBase> task)
+{
+    // 任务只由排空任务执行，提前设为TASK_CLAIMED，等待结果的线程不会越过队列直接执行它
+    task->enqueueTime_ = std::chrono::steady_clock::now();
+    task->runState_.store(TaskBase::TASK_CLAIMED, std::memory_order_relaxed);
+    StrandNode* node = new (TaskMemoryPool::allocate(sizeof(StrandNode))) StrandNode();
+    node->task = std::move(task);
+    StrandNode* prev = self->head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+    // 节点链接之后再计数，排空任务看到的计数不会超过已经放入的任务
+    if (self->size_.fetch_add(1, std::memory_order_acq_rel) == 0)
+    {
+        schedule(self);
+    }
+}
+
+// 提交排空任务
+void StrandState::schedule(const std::shared_ptr<StrandState>& self)
+{
+    if (!self->pool_->submitStrand(makeTask<StrandTask>(self)))
+    {
+        drain(self);
+    }
+}
+
+// 取出队头任务
+std::shared_ptr<TaskBase> StrandState::pop()
+{
+    // 计数大于0时任务已经放入，但更早的生产者可能刚交换完head_还没有链接节点，短暂自旋等待
+    StrandNode* next;
+    while ((next = tail_->next.load(std::memory_order_acquire)) == nullptr)
+    {
+        std::this_thread::yield();
+    }
+    std::shared_ptr<TaskBase> task = std::move(next->task);
+    if (tail_ != &stub_)
+    {
+        tail_->~StrandNode();
+        TaskMemoryPool::deallocate(tail_, sizeof(StrandNode));
+    }
+    tail_ = next;
+    return task;
+}
+
+// 依次执行队列中的任务
+void StrandState::drain(const std::shared_ptr<StrandState>& self)
+{
+    StrandState& state = *self;
+    for (;;)
+    {
+        for (int i = 0; i < STRAND_BATCH_SIZE; i++)
+        {
+            state.pool_->executeTask(state.pop());
+            // 执行完再递减计数，计数变为0后新放入的任务由它的生产者重新提交排空任务
+            if (state.size_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                return;
+            }
+        }
+        // 连续执行了STRAND_BATCH_SIZE个任务：重新排到线程池队列末尾，排空权交给新的排空任务
+        // 任务队列满或线程池已经关闭时不能提交，继续在当前线程执行
+        if (state.pool_->submitStrand(makeTask<StrandTask>(self)))
+        {
+            return;
+        }
+    }
+}
+
+// 丢弃队列中的所有任务
+void StrandState::discardAll(const std::shared_ptr<StrandState>& self, SubmitStatus status)
+{
+    StrandState& state = *self;
+    do
+    {
+        state.pool_->discardTask(state.pop(), status);
+    } while (state.size_.fetch_sub(1, std::memory_order_acq_rel) != 1);
+}
+
+// 创建关联线程池的Strand
+Strand::Strand(ThreadPool& pool)
+    : state_(makeTask<StrandState>(&pool))
+{}
+
+// 还没有执行完的任务数量
+size_t Strand::pending() const
+{
+    return state_->size_.load(std::memory_order_relaxed);
+}
+
+// 关联的线程池
+ThreadPool* Strand::poolOf() const
+{
+    return state_->pool_;
+}
+
+// 把任务放入队列
+void Strand::push(std::shared_ptr<TaskBase> task)
+{
+    StrandState::push(state_, std::move(task));
+}
+
+/*************************任务依赖图类方法实现*************************/
+// 任务依赖图一次执行的共享状态
+class GraphRun
+{
+public:
+    GraphRun(const TaskGraph& graph, ThreadPool* pool)
+        : graph_(graph)
+        , pool_(pool)
+        , pending_(new std::atomic_int[graph.nodes_.size()])
+        , remaining_(graph.nodes_.size())
+        , failed_(false)
+    {
+        for (size_t i = 0; i < graph.nodes_.size(); i++)
+        {
+            pending_[i].store(graph.nodes_[i].predecessorSize_, std::memory_order_relaxed);
+        }
+        if (graph.nodes_.empty())
+        {
+            done_.set();
+        }
+    }
+
+    // 把就绪的节点放入任务队列
+    static void submit(const std::shared_ptr<GraphRun>& self, int node);
+    // 执行节点，之后沿着第一个就绪的后继在当前线程继续执行
+    void execute(const std::shared_ptr<GraphRun>& self, int node);
+    // 节点执行失败或者没有执行就被丢弃：记录第一个异常，之后就绪的节点不再执行
+    void fail(std::exception_ptr e);
+
+    bool isReady() const { return done_.isSet(); }
+    void wait() { done_.wait(); }
+    std::exception_ptr error() const { return failed_.load(std::memory_order_acquire) ? error_ : nullptr; }
+
+    ThreadPool* pool() const { return pool_; }
+
+private:
+    const TaskGraph& graph_;
+    ThreadPool* pool_;
+    std::unique_ptr<std::atomic_int[]> pending_; // 每个节点还没有执行完的前驱数量
+    std::atomic<size_t> remaining_; // 还没有执行完的节点数量
+    std::atomic_bool failed_;
+    std::atomic_bool errorSet_{false};
+    std::exception_ptr error_; // 第一个异常，failed_之前写入
+    Completion done_;
+};
+
+// 任务依赖图的节点任务
+class GraphNodeTask : public TaskBase
+{
+public:
+    GraphNodeTask(std::shared_ptr<GraphRun> run, int node) : run_(std::move(run)), node_(node) {}
+    void exec() override { run_->execute(run_, node_); }
+    // 没有执行就被丢弃(例如线程池关闭时被shutdown()返回后discard())：按执行失败处理，继续向后继传递完成
+    void discard() override
+    {
+        run_->fail(std::make_exception_ptr(std::runtime_error(submitStatusText(submitStatus()))));
+        run_->execute(run_, node_);
+    }
+
+private:
+    std::shared_ptr<GraphRun> run_;
+    int node_;
+};
+
+// 把就绪的节点放入任务队列
+void GraphRun::submit(const std::shared_ptr<GraphRun>& self, int node)
+{
+    // 和then()的后续任务一样，任务队列满或线程池已经关闭时直接在当前线程执行
+    self->pool_->submitContinuation(makeTask<GraphNodeTask>(self, node));
+}
+
+// 执行节点
+void GraphRun::execute(const std::shared_ptr<GraphRun>& self, int node)
+{
+    while (node >= 0)
+    {
+        const TaskGraph::Node& current = graph_.nodes_[node];
+        if (!failed_.load(std::memory_order_acquire))
+        {
+            try
+            {
+                current.func_();
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+        }
+        // 最后一个前驱执行完时后继就绪：第一个在当前线程继续执行，其余的放入任务队列
+        int next = -1;
+        for (int successor : current.successors_)
+        {
+            if (pending_[successor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                if (next < 0)
+                {
+                    next = successor;
+                }
+                else
+                {
+                    submit(self, successor);
+                }
+            }
+        }
+        // 就绪的后继还没有执行完，remaining_不会在这里减到0
+        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            done_.set();
+        }
+        node = next;
+    }
+}
+
+// 记录第一个异常
+void GraphRun::fail(std::exception_ptr e)
+{
+    if (!errorSet_.exchange(true, std::memory_order_acq_rel))
+    {
+        error_ = e;
+        failed_.store(true, std::memory_order_release);
+    }
+}
+
+// 所有节点是否都已经执行完
+bool GraphResult::isReady() const
+{
+    return run_->isReady();
+}
+
+// 阻塞直到所有节点执行完
+void GraphResult::wait()
+{
+    GraphRun* run = run_.get();
+    if (!run->isReady())
+    {
+        if (pool_ == nullptr)
+        {
+            run->wait();
+        }
+        else
+        {
+            pool_->helpWait(nullptr, [run]() { return run->isReady(); }, [run]() { run->wait(); });
+        }
+    }
+    if (std::exception_ptr e = run->error())
+    {
+        std::rethrow_exception(e);
+    }
+}
+
+// 添加节点
+int TaskGraph::addNode(std::function<void()> func)
+{
+    nodes_.emplace_back();
+    nodes_.back().func_ = std::move(func);
+    checked_ = false;
+    return static_cast<int>(nodes_.size() - 1);
+}
+
+// 添加依赖
+void TaskGraph::addEdge(int from, int to)
+{
+    nodes_.at(from).successors_.push_back(to);
+    nodes_.at(to).predecessorSize_++;
+    checked_ = false;
+}
+
+// 检查图中是否有环：按拓扑顺序(Kahn算法)能访问到所有节点时没有环
+bool TaskGraph::isAcyclic() const
+{
+    std::vector<int> pending(nodes_.size());
+    std::vector<int> ready;
+    for (size_t i = 0; i < nodes_.size(); i++)
+    {
+        pending[i] = nodes_[i].predecessorSize_;
+        if (pending[i] == 0) ready.push_back(static_cast<int>(i));
+    }
+    size_t visited = 0;
+    while (!ready.empty())
+    {
+        int node = ready.back();
+        ready.pop_back();
+        visited++;
+        for (int successor : nodes_[node].successors_)
+        {
+            if (--pending[successor] == 0) ready.push_back(successor);
+        }
+    }
+    return visited == nodes_.size();
+}
+
+// 在线程池上执行一次整个图
+GraphResult TaskGraph::run(ThreadPool& pool)
+{
+    if (!checked_)
+    {
+        if (!isAcyclic())
+        {
+            throw std::logic_error("task graph has a cycle");
+        }
+        roots_.clear();
+        for (size_t i = 0; i < nodes_.size(); i++)
+        {
+            if (nodes_[i].predecessorSize_ == 0) roots_.push_back(static_cast<int>(i));
+        }
+        checked_ = true;
+    }
+    auto run = std::make_shared<GraphRun>(*this, &pool);
+    for (int root : roots_)
+    {
+        GraphRun::submit(run, root);
+    }
+    return GraphResult(run, &pool);
+}
+
+/*************************执行器组类方法实现*************************/
+// 一个执行器组的队列和调度状态，除scheduler_以外由GroupScheduler::mtx_保护
+class GroupState
+{
+public:
+    GroupState(std::shared_ptr<GroupScheduler> scheduler, int weight, size_t maxQueued)
+        : scheduler_(std::move(scheduler))
+        , maxQueued_(maxQueued)
+        , stride_(strideOf(weight))
+        , pass_(0)
+        , active_(false)
+    {}
+
+    // 权重对应的步长：每执行一个任务pass_增加一个步长，权重越大步长越小，被选中的次数越多
+    static uint64_t strideOf(int weight)
+    {
+        return GROUP_STRIDE / static_cast<uint64_t>(std::min(std::max(weight, 1), GROUP_MAX_WEIGHT));
+    }
+
+    const std::shared_ptr<GroupScheduler> scheduler_;
+    std::deque<std::shared_ptr<TaskBase>> queue_; // 组内排队的任务，可能有已经被取消或直接执行的记录
+    size_t maxQueued_;
+    uint64_t stride_;
+    uint64_t pass_; // 调度进度，有任务的组中pass_最小的先执行
+    bool active_; // 队列不为空，在调度器的active_列表中
+};
+
+// 一个线程池上所有执行器组共用的调度器
+// 每个放入组队列的任务对应线程池任务队列中的一个调度任务，调度任务执行时才决定执行哪个组的任务，
+// 因此线程池的队列顺序不影响各组之间的份额，调度任务可以被任何线程执行
+class GroupScheduler : public std::enable_shared_from_this<GroupScheduler>
+{
+public:
+    explicit GroupScheduler(ThreadPool* pool) : pool_(pool), pass_(0) {}
+
+    // 把任务放入组队列并提交调度任务
+    SubmitStatus push(const std::shared_ptr<GroupState>& group, const std::shared_ptr<TaskBase>& task);
+    // 调度任务：按权重选出一个任务执行
+    void runOne();
+    // 调度任务没有执行就被丢弃：按同样的顺序选出一个任务，以相同的状态通知等待它的线程
+    void discardOne(SubmitStatus status);
+
+    ThreadPool* const pool_;
+    std::mutex mtx_;
+
+private:
+    // 取出pass_最小的组的队头任务并取得执行权，没有可以执行的任务时返回空
+    std::shared_ptr<TaskBase> pick();
+
+    std::vector<std::shared_ptr<GroupState>> active_; // 队列不为空的组，组的数量很少，按顺序查找
+    uint64_t pass_; // 最近一次被选中的组的pass_，重新变为活跃的组从这里开始，不积累空闲时的份额
+};
+
+// 调度任务：线程池任务队列中的占位任务，执行时由调度器选择真正执行的任务
+class GroupTask : public TaskBase
+{
+public:
+    explicit GroupTask(std::shared_ptr<GroupScheduler> scheduler) : scheduler_(std::move(scheduler)) {}
+    void exec() override { scheduler_->runOne(); }
+    void discard() override { scheduler_->discardOne(submitStatus()); }
+
+private:
+    std::shared_ptr<GroupScheduler> scheduler_;
+};
+
+// 取出pass_最小的组的队头任务
+std::shared_ptr<TaskBase> GroupScheduler::pick()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    while (!active_.empty())
+    {
+        auto best = std::min_element(active_.begin(), active_.end(),
+            [](const std::shared_ptr<GroupState>& a, const std::shared_ptr<GroupState>& b) { return a->pass_ < b->pass_; });
+        GroupState& group = **best;
+        std::shared_ptr<TaskBase> task = std::move(group.queue_.front());
+        group.queue_.pop_front();
+        // 已经被取消或被等待的线程直接执行过的记录直接跳过，不计入份额
+        int expected = TaskBase::TASK_QUEUED;
+        bool claimed = task->runState_.compare_exchange_strong(expected, TaskBase::TASK_CLAIMED,
+            std::memory_order_acq_rel);
+        if (claimed)
+        {
+            pass_ = group.pass_;
+            group.pass_ += group.stride_;
+        }
+        if (group.queue_.empty())
+        {
+            group.active_ = false;
+            *best = std::move(active_.back());
+            active_.pop_back();
+        }
+        if (claimed) return task;
+    }
+    return nullptr;
+}
+
+// 把任务放入组队列并提交调度任务
+SubmitStatus GroupScheduler::push(const std::shared_ptr<GroupState>& group, const std::shared_ptr<TaskBase>& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (group->maxQueued_ > 0 && group->queue_.size() >= group->maxQueued_)
+        {
+            task->submitStatus_.store(SubmitStatus::SUBMIT_QUEUE_FULL, std::memory_order_release);
+            pool_->rejected_.fetch_add(1, std::memory_order_relaxed);
+            return SubmitStatus::SUBMIT_QUEUE_FULL;
+        }
+        task->enqueueTime_ = std::chrono::steady_clock::now();
+        task->submitStatus_.store(SubmitStatus::SUBMIT_OK, std::memory_order_relaxed);
+        task->runState_.store(TaskBase::TASK_QUEUED, std::memory_order_release);
+        group->queue_.push_back(task);
+        if (!group->active_)
+        {
+            group->active_ = true;
+            group->pass_ = std::max(group->pass_, pass_);
+            active_.push_back(group);
+        }
+    }
+    SubmitStatus status = pool_->enqueueTask(makeTask<GroupTask>(shared_from_this()), pool_->overflowPolicy_);
+    if (ThreadPool::isAccepted(status))
+    {
+        return SubmitStatus::SUBMIT_OK;
+    }
+    // 调度任务没有提交成功：组队列中的记录和调度任务要一一对应，先把自己的记录从组队列中移除
+    bool removed = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = std::find(group->queue_.rbegin(), group->queue_.rend(), task);
+        if (it != group->queue_.rend())
+        {
+            group->queue_.erase(std::next(it).base());
+            removed = true;
+            if (group->queue_.empty() && group->active_)
+            {
+                group->active_ = false;
+                active_.erase(std::find(active_.begin(), active_.end(), group));
+            }
+        }
+    }
+    if (removed)
+    {
+        // 移除之前可能已经被取消，结果由cancel()通知
+        int expected = TaskBase::TASK_QUEUED;
+        if (task->runState_.compare_exchange_strong(expected, TaskBase::TASK_CLAIMED, std::memory_order_acq_rel))
+        {
+            task->runState_.store(TaskBase::TASK_CREATED, std::memory_order_relaxed);
+            task->submitStatus_.store(status, std::memory_order_release);
+        }
+        return status;
+    }
+    // 记录已经被其他提交的调度任务取走(任务已经执行或正在执行)，那次提交的记录少了一个调度任务：
+    // 和定时器到期一样放入溢出队列补上，线程池已经关闭时按同样的状态丢弃一个记录
+    status = pool_->enqueueTask(makeTask<GroupTask>(shared_from_this()), OverflowPolicy::OVERFLOW_SPILL);
+    if (!ThreadPool::isAccepted(status))
+    {
+        discardOne(status);
+    }
+    return SubmitStatus::SUBMIT_OK;
+}
+
+// 调度任务：按权重选出一个任务执行
+void GroupScheduler::runOne()
+{
+    std::shared_ptr<TaskBase> task = pick();
+    if (task != nullptr)
+    {
+        pool_->executeTask(task);
+    }
+}
+
+// 调度任务被丢弃
+void GroupScheduler::discardOne(SubmitStatus status)
+{
+    std::shared_ptr<TaskBase> task = pick();
+    if (task != nullptr)
+    {
+        pool_->discardTask(task, status);
+    }
+}
+
+ExecutorGroup::ExecutorGroup(ThreadPool& pool, int weight, size_t maxQueued)
+{
+    std::shared_ptr<GroupScheduler> scheduler;
+    {
+        std::lock_guard<std::mutex> lock(pool.groupMtx_);
+        if (pool.groupScheduler_ == nullptr)
+        {
+            pool.groupScheduler_ = std::make_shared<GroupScheduler>(&pool);
+        }
+        scheduler = pool.groupScheduler_;
+    }
+    state_ = std::make_shared<GroupState>(std::move(scheduler), weight, maxQueued);
+}
+
+// 组内排队的任务数量
+size_t ExecutorGroup::pending() const
+{
+    std::lock_guard<std::mutex> lock(state_->scheduler_->mtx_);
+    return state_->queue_.size();
+}
+
+// 修改权重
+void ExecutorGroup::setWeight(int weight)
+{
+    std::lock_guard<std::mutex> lock(state_->scheduler_->mtx_);
+    state_->stride_ = GroupState::strideOf(weight);
+}
+
+// 关联的线程池
+ThreadPool* ExecutorGroup::poolOf() const
+{
+    return state_->scheduler_->pool_;
+}
+
+// 把任务放入组队列并提交调度任务
+SubmitStatus ExecutorGroup::push(const std::shared_ptr<TaskBase>& task)
+{
+    return state_->scheduler_->push(state_, task);
+}
+
+/*************************定时器类方法实现*************************/
+// 时间轮槽位链表的节点，槽位本身是不带数据的哨兵节点
+struct TimerLink
+{
+    TimerLink* prev_ = nullptr;
+    TimerLink* next_ = nullptr;
+};
+
+// 时间轮上的定时器：一次性的延迟任务或周期任务，挂在槽位的侵入式双向链表上
+// 除running_以外的成员由TimerWheel::mtx_保护
+struct TimerEntry : TimerLink
+{
+    uint64_t expire_ = 0; // 到期的tick(时间轮创建后的毫秒数)
+    uint64_t period_ = 0; // 周期(tick)，0表示一次性
+    std::shared_ptr<TaskBase> task_; // 一次性：到期时提交的任务
+    std::function<void()> func_; // 周期：每次到期时执行的函数
+    std::atomic_bool running_{false}; // 周期：上一次提交的执行还没有结束
+    bool canceled_ = false;
+    std::shared_ptr<TimerEntry> self_; // 挂在时间轮上(或正在到期处理)时持有自己，摘下后释放
+    std::weak_ptr<TimerWheel> wheel_; // TimerHandle::cancel()时找到时间轮，线程池析构后失效
+};
+
+// 周期任务每次到期提交的任务，执行完之前同一个周期任务不会再提交
+class TimerFireTask : public TaskBase
+{
+public:
+    explicit TimerFireTask(std::shared_ptr<TimerEntry> entry) : entry_(std::move(entry)) {}
+    void exec() override
+    {
+        try
+        {
+            entry_->func_();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "periodic task threw: " << e.what() << std::endl;
+        }
+        catch (...)
+        {
+            std::cerr << "periodic task threw an unknown exception." << std::endl;
+        }
+        entry_->running_.store(false, std::memory_order_release);
+    }
+    void discard() override { entry_->running_.store(false, std::memory_order_release); }
+
+private:
+    std::shared_ptr<TimerEntry> entry_;
+};
+
+// 分层时间轮(精度1ms)：第0层256个槽位，第1~3层各64个槽位，第L层一个槽位的跨度是第L-1层的整圈
+// 定时器按距离到期的时间放入对应层的槽位，插入和取消都是O(1)；第0层转完一圈时把上一层的一个槽位重新放置到下面的层
+// 定时线程只在有定时器时运行，休眠到第0层下一个非空槽位或下一次重新放置的时间，不按固定周期空转
+class TimerWheel
+{
+public:
+    explicit TimerWheel(ThreadPool* pool)
+        : pool_(pool)
+        , base_(std::chrono::steady_clock::now())
+        , current_(0)
+        , count_(0)
+        , stopped_(false)
+    {
+        for (TimerLink& slot : slots_)
+        {
+            slot.prev_ = &slot;
+            slot.next_ = &slot;
+        }
+    }
+    ~TimerWheel()
+    {
+        std::vector<std::shared_ptr<TaskBase>> pending;
+        stop(pending);
+    }
+
+    // 加入定时器，第一次加入时启动定时线程，已经停止时返回false
+    bool add(const std::shared_ptr<TimerEntry>& entry, std::chrono::steady_clock::time_point when);
+    // 取消定时器，从槽位中摘下，返回是否由这次调用取消
+    bool cancel(TimerEntry* entry);
+    // 停止定时线程，取出还没有到期的一次性任务，周期任务不再提交
+    void stop(std::vector<std::shared_ptr<TaskBase>>& pending);
+
+private:
+    static const int LEVEL0_SLOTS = 1 << TIMER_LEVEL0_BITS;
+    static const int LEVEL_SLOTS = 1 << TIMER_LEVEL_BITS;
+    static const int SLOT_COUNT = LEVEL0_SLOTS + (TIMER_LEVELS - 1) * LEVEL_SLOTS;
+    static const uint64_t MAX_DELAY = uint64_t(1) << (TIMER_LEVEL0_BITS + (TIMER_LEVELS - 1) * TIMER_LEVEL_BITS);
+
+    // 第level层(level>0)槽位下标在tick中的起始位
+    static int levelShift(int level) { return TIMER_LEVEL0_BITS + (level - 1) * TIMER_LEVEL_BITS; }
+    TimerLink& slot(int level, uint64_t tick)
+    {
+        if (level == 0) return slots_[tick & (LEVEL0_SLOTS - 1)];
+        return slots_[LEVEL0_SLOTS + (level - 1) * LEVEL_SLOTS
+            + ((tick >> levelShift(level)) & (LEVEL_SLOTS - 1))];
+    }
+    // 时间点对应的tick：到期时间向上取整，保证不会提前到期；当前时间向下取整
+    uint64_t expireTick(std::chrono::steady_clock::time_point when) const;
+    uint64_t nowTick() const;
+    // 按到期时间和current_的距离放入对应的槽位，已经到期的放入下一个tick，调用时需持有mtx_
+    void link(TimerEntry* entry);
+    static void unlink(TimerEntry* entry);
+    // 把第level层当前的槽位重新放置到下面的层，调用时需持有mtx_
+    void cascade(int level);
+    // 推进到tick now，到期的定时器从槽位中摘下放入due，调用时需持有mtx_
+    void advance(uint64_t now, std::vector<std::shared_ptr<TimerEntry>>& due);
+    // 下一次需要醒来的tick：第0层这一圈中下一个非空槽位，没有时为这一圈结束(重新放置上一层)，调用时需持有mtx_
+    uint64_t nextTick();
+    // 提交到期的定时器，调用时不能持有mtx_(提交任务可能要加taskQueMtx_)
+    void fire(const std::shared_ptr<TimerEntry>& entry);
+    // 定时线程函数
+    void run();
+
+    ThreadPool* pool_;
+    const std::chrono::steady_clock::time_point base_; // tick 0对应的时间
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::thread thread_;
+    TimerLink slots_[SLOT_COUNT];
+    uint64_t current_; // 已经处理完的tick
+    size_t count_; // 挂在时间轮上的定时器数量
+    bool stopped_;
+};
+
+// 到期时间对应的tick，向上取整
+uint64_t TimerWheel::expireTick(std::chrono::steady_clock::time_point when) const
+{
+    if (when <= base_) return 0;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when - base_).count();
+    return static_cast<uint64_t>((ns + 999999) / 1000000);
+}
+
+// 当前时间对应的tick，向下取整
+uint64_t TimerWheel::nowTick() const
+{
+    auto elapsed = std::chrono::steady_clock::now() - base_;
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+// 按距离到期的时间放入对应层的槽位
+void TimerWheel::link(TimerEntry* entry)
+{
+    // 已经到期的定时器在下一个tick处理；超出最高层范围的先放在最高层最远的槽位，重新放置时再按真实到期时间放置
+    uint64_t tick = std::min(std::max(entry->expire_, current_ + 1), current_ + MAX_DELAY - 1);
+    uint64_t delta = tick - current_;
+    int level = 0;
+    while (level + 1 < TIMER_LEVELS && delta >= (uint64_t(1) << levelShift(level + 1)))
+    {
+        level++;
+    }
+    TimerLink& head = slot(level, tick);
+    entry->prev_ = head.prev_;
+    entry->next_ = &head;
+    head.prev_->next_ = entry;
+    head.prev_ = entry;
+}
+
+// 从槽位中摘下
+void TimerWheel::unlink(TimerEntry* entry)
+{
+    entry->prev_->next_ = entry->next_;
+    entry->next_->prev_ = entry->prev_;
+    entry->prev_ = nullptr;
+    entry->next_ = nullptr;
+}
+
+// 把第level层当前的槽位重新放置到下面的层
+void TimerWheel::cascade(int level)
+{
+    TimerLink& head = slot(level, current_);
+    TimerLink* node = head.next_;
+    head.prev_ = &head;
+    head.next_ = &head;
+    while (node != &head)
+    {
+        TimerLink* next = node->next_;
+        link(static_cast<TimerEntry*>(node));
+        node = next;
+    }
+}
+
+// 推进到tick now，摘下到期的定时器
+void TimerWheel::advance(uint64_t now, std::vector<std::shared_ptr<TimerEntry>>& due)
+{
+    while (current_ < now && count_ > 0)
+    {
+        current_++;
+        // 第0层转完一圈：重新放置上一层当前的槽位，上一层也转完一圈时继续向上
+        if ((current_ & (LEVEL0_SLOTS - 1)) == 0)
+        {
+            for (int level = 1; level < TIMER_LEVELS; level++)
+            {
+                cascade(level);
+                if (((current_ >> levelShift(level)) & (LEVEL_SLOTS - 1)) != 0) break;
+            }
+        }
+        // 第0层槽位中的定时器都在这个tick到期
+        TimerLink& head = slot(0, current_);
+        while (head.next_ != &head)
+        {
+            TimerEntry* entry = static_cast<TimerEntry*>(head.next_);
+            unlink(entry);
+            count_--;
+            due.emplace_back(std::move(entry->self_));
+        }
+    }
+    // 没有定时器时直接跳到当前时间，之后加入的定时器从这里开始计算
+    current_ = std::max(current_, now);
+}
+
+// 下一次需要醒来的tick
+uint64_t TimerWheel::nextTick()
+{
+    uint64_t end = (current_ | (LEVEL0_SLOTS - 1)) + 1;
+    for (uint64_t tick = current_ + 1; tick < end; tick++)
+    {
+        TimerLink& head = slot(0, tick);
+        if (head.next_ != &head) return tick;
+    }
+    return end;
+}
+
+// 加入定时器
+bool TimerWheel::add(const std::shared_ptr<TimerEntry>& entry, std::chrono::steady_clock::time_point when)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (stopped_) return false;
+    if (!thread_.joinable())
+    {
+        thread_ = std::thread(&TimerWheel::run, this);
+    }
+    // 一直空闲的时间轮先推进到当前时间，按当前时间计算放入的层
+    if (count_ == 0)
+    {
+        current_ = std::max(current_, nowTick());
+    }
+    entry->expire_ = expireTick(when);
+    entry->self_ = entry;
+    link(entry.get());
+    // 新的定时器可能比定时线程正在等待的时间更早到期
+    if (count_++ == 0 || entry->expire_ <= current_ + LEVEL0_SLOTS)
+    {
+        cond_.notify_one();
+    }
+    return true;
+}
+
+// 取消定时器
+bool TimerWheel::cancel(TimerEntry* entry)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (entry->canceled_ || stopped_) return false;
+    entry->canceled_ = true;
+    // 正在到期处理的定时器不在槽位中，提交之后发现已经取消就不再放回
+    if (entry->prev_ != nullptr)
+    {
+        unlink(entry);
+        count_--;
+        entry->self_.reset();
+    }
+    return true;
+}
+
+// 停止定时线程，取出还没有到期的一次性任务
+void TimerWheel::stop(std::vector<std::shared_ptr<TaskBase>>& pending)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (stopped_) return;
+        stopped_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+    // 定时线程已经退出，不需要再加锁
+    for (TimerLink& head : slots_)
+    {
+        while (head.next_ != &head)
+        {
+            TimerEntry* entry = static_cast<TimerEntry*>(head.next_);
+            unlink(entry);
+            entry->canceled_ = true;
+            std::shared_ptr<TaskBase> task = std::move(entry->task_);
+            entry->self_.reset();
+            if (task == nullptr) continue;
+            // 已经被cancel()取得执行权的任务不再返回
+            int expected = TaskBase::TASK_DELAYED;
+            if (task->runState_.compare_exchange_strong(expected, TaskBase::TASK_CLAIMED, std::memory_order_acq_rel))
+            {
+                task->submitStatus_.store(SubmitStatus::SUBMIT_SHUTDOWN, std::memory_order_release);
+                pending.emplace_back(std::move(task));
+            }
+        }
+    }
+    count_ = 0;
+}
+
+// 提交到期的定时器
+void TimerWheel::fire(const std::shared_ptr<TimerEntry>& entry)
+{
+    // 到期时任务队列满也不阻塞定时线程，放入溢出队列
+    const OverflowPolicy policy = OverflowPolicy::OVERFLOW_SPILL;
+    if (entry->task_ != nullptr)
+    {
+        std::shared_ptr<TaskBase> task = std::move(entry->task_);
+        // 和cancel()竞争执行权，取得执行权的一方负责通知等待的线程
+        int expected = TaskBase::TASK_DELAYED;
+        if (!task->runState_.compare_exchange_strong(expected, TaskBase::TASK_CREATED, std::memory_order_acq_rel))
+        {
+            return;
+        }
+        // 没有提交成功(线程池正在关闭、任务已经过期)：状态已经记录在任务中，通知等待的线程
+        if (!ThreadPool::isAccepted(pool_->enqueueTask(task, policy)))
+        {
+            task->discard();
+        }
+        return;
+    }
+    // 周期任务：上一次还没有执行完时跳过这一次
+    if (entry->running_.exchange(true, std::memory_order_acq_rel)) return;
+    auto task = makeTask<TimerFireTask>(entry);
+    if (!ThreadPool::isAccepted(pool_->enqueueTask(task, policy)))
+    {
+        entry->running_.store(false, std::memory_order_release);
+    }
+}
+
+// 定时线程函数
+void TimerWheel::run()
+{
+    std::vector<std::shared_ptr<TimerEntry>> due;
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!stopped_)
+    {
+        if (count_ == 0)
+        {
+            cond_.wait(lock);
+            continue;
+        }
+        advance(nowTick(), due);
+        if (due.empty())
+        {
+            cond_.wait_until(lock, base_ + std::chrono::milliseconds(nextTick()));
+            continue;
+        }
+        lock.unlock();
+        for (auto& entry : due)
+        {
+            fire(entry);
+        }
+        lock.lock();
+        // 没有取消的周期任务按固定频率放回，到期处理耽误了多个周期时跳过错过的周期
+        for (auto& entry : due)
+        {
+            if (entry->period_ == 0 || entry->canceled_ || stopped_) continue;
+            entry->expire_ += entry->period_;
+            if (entry->expire_ <= current_)
+            {
+                entry->expire_ += (current_ - entry->expire_) / entry->period_ * entry->period_ + entry->period_;
+            }
+            entry->self_ = entry;
+            link(entry.get());
+            count_++;
+        }
+        due.clear();
+    }
+}
+
+// 周期任务句柄：取消周期任务
+bool TimerHandle::cancel()
+{
+    if (entry_ == nullptr) return false;
+    std::shared_ptr<TimerWheel> wheel = entry_->wheel_.lock();
+    return wheel != nullptr && wheel->cancel(entry_.get());
+}
+
+// 加入时间轮，第一次使用时创建时间轮
+SubmitStatus ThreadPool::scheduleTimer(const std::shared_ptr<TaskBase>& task, std::chrono::milliseconds delay)
+{
+    std::shared_ptr<TimerWheel> wheel;
+    {
+        std::lock_guard<std::mutex> lock(timerMtx_);
+        if (!isShutdown_)
+        {
+            if (timerWheel_ == nullptr) timerWheel_ = std::make_shared<TimerWheel>(this);
+            wheel = timerWheel_;
+        }
+    }
+    auto entry = makeTask<TimerEntry>(); // 定时器也从任务内存池分配
+    entry->task_ = task;
+    entry->wheel_ = wheel;
+    // 先设为TASK_DELAYED再放入时间轮，定时线程随时可能到期提交它
+    task->submitStatus_.store(SubmitStatus::SUBMIT_OK, std::memory_order_relaxed);
+    task->runState_.store(TaskBase::TASK_DELAYED, std::memory_order_release);
+    if (wheel == nullptr || !wheel->add(entry, std::chrono::steady_clock::now() + delay))
+    {
+        task->runState_.store(TaskBase::TASK_CREATED, std::memory_order_relaxed);
+        task->submitStatus_.store(SubmitStatus::SUBMIT_SHUTDOWN, std::memory_order_release);
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return SubmitStatus::SUBMIT_SHUTDOWN;
+    }
+    return SubmitStatus::SUBMIT_OK;
+}
+
+// 延迟提交任务
+Result ThreadPool::submitAfter(std::chrono::milliseconds delay, std::shared_ptr<Task> task, TaskPriority priority)
+{
+    task->priority_ = priority;
+    if (!isAccepted(scheduleTimer(task, delay)))
+    {
+        return Result(task, false, this);
+    }
+    return Result(task, true, this);
+}
+
+// 周期提交任务
+TimerHandle ThreadPool::scheduleEvery(std::chrono::milliseconds period, std::function<void()> func)
+{
+    std::shared_ptr<TimerWheel> wheel;
+    {
+        std::lock_guard<std::mutex> lock(timerMtx_);
+        if (!isShutdown_)
+        {
+            if (timerWheel_ == nullptr) timerWheel_ = std::make_shared<TimerWheel>(this);
+            wheel = timerWheel_;
+        }
+    }
+    auto entry = makeTask<TimerEntry>(); // 定时器也从任务内存池分配
+    entry->period_ = std::max<uint64_t>(1, static_cast<uint64_t>(period.count()));
+    entry->func_ = std::move(func);
+    entry->wheel_ = wheel;
+    // 线程池已经关闭：返回已经取消的句柄
+    if (wheel == nullptr || !wheel->add(entry, std::chrono::steady_clock::now() + period))
+    {
+        entry->canceled_ = true;
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return TimerHandle(std::move(entry));
+}
+
+// 停止定时线程
+void ThreadPool::stopTimer(std::vector<std::shared_ptr<TaskBase>>& pending)
+{
+    std::shared_ptr<TimerWheel> wheel;
+    {
+        std::lock_guard<std::mutex> lock(timerMtx_);
+        wheel = timerWheel_;
+    }
+    if (wheel != nullptr)
+    {
+        wheel->stop(pending);
+    }
+}
+
+/*************************统计信息类方法实现*************************/
+// 耗时所在的直方图桶：floor(log2(ns))
+static int latencyBucket(uint64_t ns)
+{
+    int bucket = 0;
+    while (ns > 1 && bucket < LATENCY_BUCKET_SIZE - 1)
+    {
+        ns >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// 构造，C++17中std::atomic的默认构造不会初始化值
+WorkerStats::WorkerStats()
+    : completed_(0)
+    , steals_(0)
+    , busy_(0)
+    , maxWaitNs_(0)
+    , lastDequeueNs_(0)
+{
+    for (int i = 0; i < LATENCY_BUCKET_SIZE; i++)
+    {
+        waitTime_[i].store(0, std::memory_order_relaxed);
+        runTime_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+// 记录一个任务的排队耗时和执行耗时
+void WorkerStats::record(uint64_t waitNs, uint64_t runNs)
+{
+    completed_.fetch_add(1, std::memory_order_relaxed);
+    waitTime_[latencyBucket(waitNs)].fetch_add(1, std::memory_order_relaxed);
+    runTime_[latencyBucket(runNs)].fetch_add(1, std::memory_order_relaxed);
+}
+
+// 样本总数
+uint64_t LatencyHistogram::count() const
+{
+    uint64_t total = 0;
+    for (uint64_t n : buckets_) total += n;
+    return total;
+}
+
+// 百分位数所在桶的上界
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    uint64_t total = count();
+    if (total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p * total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKET_SIZE; i++)
+    {
+        seen += buckets_[i];
+        if (seen > rank) return uint64_t(2) << i;
+    }
+    return uint64_t(2) << (LATENCY_BUCKET_SIZE - 1);
+}
+/*************************任务内存池类方法实现*************************/
+// 空闲内存块，next_保存在内存块自身的前几个字节中
+struct FreeBlock
+{
+    FreeBlock* next_;
+};
+
+const size_t POOL_BATCH_SIZE = 32;              // 本地链表和全局链表之间每次转移的内存块数
+const size_t POOL_LOCAL_MAX = 2 * POOL_BATCH_SIZE; // 本地链表超过该长度时归还一批给全局链表
+
+// 全局空闲链表，每个大小等级一把锁
+struct GlobalPool
+{
+    std::mutex mtx_[TaskMemoryPool::CLASS_SIZE];
+    FreeBlock* head_[TaskMemoryPool::CLASS_SIZE] = {};
+};
+
+// 进程退出时仍可能有线程在释放任务，全局链表和它管理的内存不析构
+static GlobalPool& globalPool()
+{
+    static GlobalPool* pool = new GlobalPool();
+    return *pool;
+}
+
+// 线程本地空闲链表，只有平凡的成员，线程退出析构flusher之后仍然可以安全访问
+struct LocalPool
+{
+    FreeBlock* head_[TaskMemoryPool::CLASS_SIZE];
+    size_t count_[TaskMemoryPool::CLASS_SIZE];
+    bool exited_; // 线程已经归还了本地链表，之后的分配释放直接使用全局链表
+};
+static thread_local LocalPool localMemPool_ = {};
+
+// 把head到tail的一段链表挂到全局链表上
+static void pushGlobal(int cls, FreeBlock* head, FreeBlock* tail)
+{
+    GlobalPool& pool = globalPool();
+    std::lock_guard<std::mutex> lock(pool.mtx_[cls]);
+    tail->next_ = pool.head_[cls];
+    pool.head_[cls] = head;
+}
+
+// 线程退出时把本地链表整体归还全局链表
+struct LocalPoolFlusher
+{
+    ~LocalPoolFlusher()
+    {
+        for (int cls = 0; cls < TaskMemoryPool::CLASS_SIZE; cls++)
+        {
+            FreeBlock* head = localMemPool_.head_[cls];
+            if (head == nullptr) continue;
+            FreeBlock* tail = head;
+            while (tail->next_ != nullptr) tail = tail->next_;
+            pushGlobal(cls, head, tail);
+            localMemPool_.head_[cls] = nullptr;
+            localMemPool_.count_[cls] = 0;
+        }
+        localMemPool_.exited_ = true;
+    }
+};
+static thread_local LocalPoolFlusher localMemPoolFlusher_;
+
+static size_t blockSize(int cls)
+{
+    return (cls + 1) * TaskMemoryPool::BLOCK_ALIGN;
+}
+
+// 从全局链表取一批内存块放入本地链表，全局链表为空时分配一整块slab切分
+static void refill(int cls)
+{
+    // 取地址使flusher在当前线程构造，线程退出时才会归还本地链表
+    (void)&localMemPoolFlusher_;
+
+    GlobalPool& pool = globalPool();
+    {
+        std::lock_guard<std::mutex> lock(pool.mtx_[cls]);
+        FreeBlock* head = pool.head_[cls];
+        if (head != nullptr)
+        {
+            FreeBlock* tail = head;
+            size_t count = 1;
+            while (count < POOL_BATCH_SIZE && tail->next_ != nullptr)
+            {
+                tail = tail->next_;
+                count++;
+            }
+            pool.head_[cls] = tail->next_;
+            tail->next_ = nullptr;
+            localMemPool_.head_[cls] = head;
+            localMemPool_.count_[cls] = count;
+            return;
+        }
+    }
+
+    // slab不归还给系统，切分出的内存块一直在空闲链表之间循环使用
+    size_t size = blockSize(cls);
+    char* slab = static_cast<char*>(::operator new(size * POOL_BATCH_SIZE));
+    FreeBlock* head = nullptr;
+    for (size_t i = POOL_BATCH_SIZE; i > 0; i--)
+    {
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + (i - 1) * size);
+        block->next_ = head;
+        head = block;
+    }
+    localMemPool_.head_[cls] = head;
+    localMemPool_.count_[cls] = POOL_BATCH_SIZE;
+}
+
+// 分配size字节的内存
+void* TaskMemoryPool::allocate(size_t size)
+{
+    if (size == 0 || size > MAX_BLOCK_SIZE)
+    {
+        return ::operator new(size);
+    }
+    int cls = static_cast<int>((size - 1) / BLOCK_ALIGN);
+    if (localMemPool_.exited_)
+    {
+        GlobalPool& pool = globalPool();
+        std::lock_guard<std::mutex> lock(pool.mtx_[cls]);
+        FreeBlock* block = pool.head_[cls];
+        if (block == nullptr) return ::operator new(blockSize(cls));
+        pool.head_[cls] = block->next_;
+        return block;
+    }
+    if (localMemPool_.head_[cls] == nullptr)
+    {
+        refill(cls);
+    }
+    FreeBlock* block = localMemPool_.head_[cls];
+    localMemPool_.head_[cls] = block->next_;
+    localMemPool_.count_[cls]--;
+    return block;
+}
+
+// 释放allocate(size)分配的内存
+void TaskMemoryPool::deallocate(void* p, size_t size)
+{
+    if (size == 0 || size > MAX_BLOCK_SIZE)
+    {
+        ::operator delete(p);
+        return;
+    }
+    int cls = static_cast<int>((size - 1) / BLOCK_ALIGN);
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    if (localMemPool_.exited_)
+    {
+        pushGlobal(cls, block, block);
+        return;
+    }
+    (void)&localMemPoolFlusher_;
+    block->next_ = localMemPool_.head_[cls];
+    localMemPool_.head_[cls] = block;
+    if (++localMemPool_.count_[cls] > POOL_LOCAL_MAX)
+    {
+        // 只由其他线程释放任务的线程(例如工作线程)把多出的内存块还给全局链表，供提交线程取用
+        FreeBlock* head = localMemPool_.head_[cls];
+        FreeBlock* tail = head;
+        for (size_t i = 1; i < POOL_BATCH_SIZE; i++) tail = tail->next_;
+        localMemPool_.head_[cls] = tail->next_;
+        localMemPool_.count_[cls] -= POOL_BATCH_SIZE;
+        pushGlobal(cls, head, tail);
+    }
+}
+
+/*************************优先级任务队列类方法实现*************************/
+// 构造
+PriorityTaskQueue::PriorityTaskQueue()
+    : size_(0)
+    , aging_(std::chrono::steady_clock::duration::zero())
+{}
+
+// 按任务的优先级入队
+void PriorityTaskQueue::push(std::shared_ptr<TaskBase> task)
+{
+    // 老化使用的enqueueTime_由ThreadPool在入队前记录
+    lanes_[static_cast<int>(task->priority_)].emplace(std::move(task));
+    size_++;
+}
+
+// 取出下一个要执行的任务
+std::shared_ptr<TaskBase> PriorityTaskQueue::pop()
+{
+    int lane = 0;
+    while (lanes_[lane].empty()) lane++;
+
+    // 老化：比当前优先级低的队列中，队头等待超过老化时间的任务里取等待最久的
+    if (aging_ > std::chrono::steady_clock::duration::zero())
+    {
+        auto oldest = std::chrono::steady_clock::now() - aging_;
+        for (int i = lane + 1; i < TASK_PRIORITY_SIZE; i++)
+        {
+            if (!lanes_[i].empty() && lanes_[i].front()->enqueueTime_ <= oldest)
+            {
+                oldest = lanes_[i].front()->enqueueTime_;
+                lane = i;
+            }
+        }
+    }
+
+    std::shared_ptr<TaskBase> task = std::move(lanes_[lane].front());
+    lanes_[lane].pop();
+    size_--;
+    return task;
+}
+
+// 取出某个优先级队列中等待最久的任务
+std::shared_ptr<TaskBase> PriorityTaskQueue::popFront(TaskPriority priority)
+{
+    std::queue<std::shared_ptr<TaskBase>>& lane = lanes_[static_cast<int>(priority)];
+    std::shared_ptr<TaskBase> task = std::move(lane.front());
+    lane.pop();
+    size_--;
+    return task;
+}
+/*************************工作窃取队列类方法实现*************************/
+// 所属线程从队尾压入任务
+void WorkStealingQueue::push(std::shared_ptr<TaskBase> task)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    que_.emplace_back(std::move(task));
+}
+
+// 所属线程从队尾弹出任务
+bool WorkStealingQueue::pop(std::shared_ptr<TaskBase>& task)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (que_.empty()) return false;
+    task = std::move(que_.back());
+    que_.pop_back();
+    return true;
+}
+
+// 其他线程从队头窃取任务
+bool WorkStealingQueue::steal(std::shared_ptr<TaskBase>& task)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (que_.empty()) return false;
+    task = std::move(que_.front());
+    que_.pop_front();
+    return true;
+}
+/*************************CPU拓扑类方法实现*************************/
+// 解析"0-3,8-11"格式的CPU列表
+static std::vector<int> parseCpuList(const std::string& text)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos) end = text.size();
+        std::string item = text.substr(pos, end - pos);
+        size_t dash = item.find('-');
+        try
+        {
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }
+        catch (...)
+        {
+            // 忽略空行等无法解析的内容
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+// 读取系统的CPU拓扑
+CpuTopology CpuTopology::detect()
+{
+    CpuTopology topology;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool hasMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    for (int node = 0; ; node++)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file) break;
+        std::string text;
+        std::getline(file, text);
+        std::vector<int> cpus;
+        for (int cpu : parseCpuList(text))
+        {
+            if (!hasMask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) cpus.push_back(cpu);
+        }
+        if (!cpus.empty()) topology.nodes_.emplace_back(std::move(cpus));
+    }
+    if (topology.nodes_.empty() && hasMask)
+    {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        }
+        if (!cpus.empty()) topology.nodes_.emplace_back(std::move(cpus));
+    }
+#endif
+    if (topology.nodes_.empty())
+    {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < (int)std::max(1u, std::thread::hardware_concurrency()); cpu++) cpus.push_back(cpu);
+        topology.nodes_.emplace_back(std::move(cpus));
+    }
+    return topology;
+}
+
+// CPU所在的NUMA节点
+int CpuTopology::nodeOf(int cpu) const
+{
+    for (size_t node = 0; node < nodes_.size(); node++)
+    {
+        if (std::find(nodes_[node].begin(), nodes_[node].end(), cpu) != nodes_[node].end()) return (int)node;
+    }
+    return -1;
+}
+/*************************线程类方法实现*************************/
+int Thread::generatedId_ = 0; // 静态成员变量类外初始化
+
+// 线程构造
+Thread::Thread(ThreadFunc func)
+    : func_(func)
+    , threadId_(generatedId_++)
+{}
+
+// 线程析构，线程池保证析构前线程已经退出
+Thread::~Thread()
+{
+    join();
+}
+
+#ifdef __linux__
+// pthread_create()的线程入口
+static void* threadEntry(void* arg)
+{
+    Thread* thread = static_cast<Thread*>(arg);
+    thread->run();
+    return nullptr;
+}
+#endif
+
+// 启动线程
+void Thread::start()
+{
+#ifdef __linux__
+    // 指定了栈大小：std::thread不能设置线程属性，直接用pthread_create()创建，失败时退回默认栈大小
+    if (stackSize_ > 0)
+    {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (pthread_attr_setstacksize(&attr, std::max<size_t>(stackSize_, PTHREAD_STACK_MIN)) == 0
+            && pthread_create(&nativeThread_, &attr, threadEntry, this) == 0)
+        {
+            nativeStarted_ = true;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    if (!nativeStarted_)
+    {
+        thread_ = std::thread(func_, threadId_);
+    }
+    // 绑定线程运行的CPU
+    if (!cpus_.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus_)
+        {
+            CPU_SET(cpu, &set);
+        }
+        pthread_setaffinity_np(nativeStarted_ ? nativeThread_ : thread_.native_handle(), sizeof(set), &set);
+    }
+#else
+    // 创建一个线程对象来执行线程函数，并向线程函数func_传递参数threadId_
+    thread_ = std::thread(func_, threadId_);
+#endif
+    // 原本设置分离线程t.detach()，线程池无法知道线程什么时候真正结束
+    // 现在保留std::thread对象，线程退出后由线程池join()
+}
+
+// 执行线程函数
+void Thread::run()
+{
+    func_(threadId_);
+}
+
+// 等待线程函数返回
+void Thread::join()
+{
+#ifdef __linux__
+    if (nativeStarted_)
+    {
+        pthread_join(nativeThread_, nullptr);
+        nativeStarted_ = false;
+        return;
+    }
+#endif
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+// 设置线程允许运行的CPU
+void Thread::setAffinity(std::vector<int> cpus)
+{
+    cpus_ = std::move(cpus);
+}
+
+// 设置线程栈大小
+void Thread::setStackSize(size_t bytes)
+{
+    stackSize_ = bytes;
+}
+
+// 获取线程ID
+int Thread::getId() const
+{
+    return threadId_;
+}
+
+/*************************调试跟踪类方法实现*************************/
+#ifdef THREADPOOL_TRACE
+// 单生产者单消费者环形缓冲区：所属线程写入，后台输出线程读取，都不需要加锁
+struct TraceBuffer
+{
+    static const size_t CAPACITY = 4096;
+    TraceRecord records_[CAPACITY];
+    std::thread::id tid_;
+    alignas(64) std::atomic<size_t> head_{0}; // 所属线程写入位置
+    alignas(64) std::atomic<size_t> tail_{0}; // 输出线程读取位置
+    std::atomic<uint64_t> dropped_{0}; // 缓冲区满时丢弃的记录数
+};
+
+// 所有线程的跟踪缓冲区，以及定期把记录输出到std::cout的后台线程
+class TraceRegistry
+{
+public:
+    static TraceRegistry& instance()
+    {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    // 登记一个线程的缓冲区，每个线程只在第一次记录时调用一次
+    void add(const std::shared_ptr<TraceBuffer>& buffer)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        buffers_.emplace_back(buffer);
+        if (!drainer_.joinable())
+        {
+            drainer_ = std::thread([this]() {
+                std::unique_lock<std::mutex> lock(mtx_);
+                while (running_)
+                {
+                    cond_.wait_for(lock, std::chrono::milliseconds(10));
+                    drain();
+                }
+            });
+        }
+    }
+
+    // 输出所有缓冲区中的记录，调用时需持有mtx_
+    void drain()
+    {
+        for (auto& buffer : buffers_)
+        {
+            size_t tail = buffer->tail_.load(std::memory_order_relaxed);
+            size_t head = buffer->head_.load(std::memory_order_acquire);
+            for (; tail != head; tail++)
+            {
+                const TraceRecord& rec = buffer->records_[tail % TraceBuffer::CAPACITY];
+                std::cout << "[" << rec.time_ / 1000 << "us] tid : " << buffer->tid_
+                          << " " << rec.msg_ << " " << rec.arg_ << "\n";
+            }
+            buffer->tail_.store(tail, std::memory_order_release);
+            uint64_t dropped = buffer->dropped_.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0)
+            {
+                std::cout << "tid : " << buffer->tid_ << " dropped " << dropped << " trace records\n";
+            }
+        }
+        std::cout.flush();
+    }
+
+    std::mutex& mutex() { return mtx_; }
+
+private:
+    TraceRegistry() : running_(true) {}
+    ~TraceRegistry()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            running_ = false;
+            cond_.notify_all();
+        }
+        if (drainer_.joinable()) drainer_.join();
+        std::lock_guard<std::mutex> lock(mtx_);
+        drain();
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::vector<std::shared_ptr<TraceBuffer>> buffers_;
+    std::thread drainer_;
+    bool running_;
+};
+
+// 记录一条跟踪信息，只写当前线程私有的缓冲区
+void Tracer::record(const char* msg, uint64_t arg)
+{
+    static thread_local std::shared_ptr<TraceBuffer> buffer;
+    if (buffer == nullptr)
+    {
+        buffer = std::make_shared<TraceBuffer>();
+        buffer->tid_ = std::this_thread::get_id();
+        TraceRegistry::instance().add(buffer);
+    }
+
+    size_t head = buffer->head_.load(std::memory_order_relaxed);
+    if (head - buffer->tail_.load(std::memory_order_acquire) >= TraceBuffer::CAPACITY)
+    {
+        // 缓冲区满了就丢弃，不能让被跟踪的线程等待输出
+        buffer->dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    TraceRecord& rec = buffer->records_[head % TraceBuffer::CAPACITY];
+    rec.time_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    rec.msg_ = msg;
+    rec.arg_ = arg;
+    buffer->head_.store(head + 1, std::memory_order_release);
+}
+
+// 立即输出所有线程缓冲区中的记录
+void Tracer::flush()
+{
+    TraceRegistry& registry = TraceRegistry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex());
+    registry.drain();
+}
+#endif
+/*************************调度事件跟踪类方法实现*************************/
+#ifdef THREADPOOL_PROFILE
+std::atomic_bool TaskTrace::enabled_{false};
+
+// 跟踪时间戳：x86下直接读时间戳计数器，导出时按记录开始和结束时的steady_clock换算
+static inline uint64_t traceClock()
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(steadyNowNs());
+#endif
+}
+
+struct TaskTraceEvent
+{
+    uint64_t time_; // traceClock()时间戳
+    uint64_t id_; // 任务编号或线程id
+    const void* pool_;
+    TraceEventType type_;
+};
+
+// 每个线程私有的事件缓冲区：只有所属线程写入，导出时读取[0, size_)
+struct TaskTraceBuffer
+{
+    static const size_t CAPACITY = 1 << 16;
+    std::unique_ptr<TaskTraceEvent[]> events_{new TaskTraceEvent[CAPACITY]};
+    std::atomic<size_t> size_{0};
+    std::atomic<uint32_t> epoch_{0}; // 事件所属的记录次数，记录次数变化后所属线程写入时清空
+    std::atomic<uint64_t> dropped_{0}; // 缓冲区满时丢弃的事件数
+    std::atomic_bool alive_{true}; // 所属线程还没有退出
+    int tid_ = 0; // 导出时的轨道编号
+    uint64_t nextId_ = 0; // 所属线程分配任务编号的计数
+};
+
+// 所有线程的事件缓冲区和本次记录的时间基准
+struct TaskTraceRegistry
+{
+    std::mutex mtx_;
+    std::vector<std::shared_ptr<TaskTraceBuffer>> buffers_;
+    int nextTid_ = 0;
+    std::atomic<uint32_t> epoch_{0};
+    uint64_t startClock_ = 0, stopClock_ = 0; // 记录开始、结束时的traceClock()
+    int64_t startNs_ = 0, stopNs_ = 0; // 记录开始、结束时的steady_clock
+};
+
+static TaskTraceRegistry& traceRegistry()
+{
+    static TaskTraceRegistry registry;
+    return registry;
+}
+
+// 线程退出时标记缓冲区，下一次start()时释放已经退出的线程的缓冲区
+struct TaskTraceHolder
+{
+    std::shared_ptr<TaskTraceBuffer> buffer_;
+    ~TaskTraceHolder()
+    {
+        if (buffer_ != nullptr) buffer_->alive_.store(false, std::memory_order_relaxed);
+    }
+};
+static thread_local TaskTraceHolder localTrace_;
+
+// 当前线程的缓冲区，第一次使用时登记；记录次数变化后清空
+static TaskTraceBuffer& localTraceBuffer()
+{
+    TaskTraceRegistry& registry = traceRegistry();
+    if (localTrace_.buffer_ == nullptr)
+    {
+        auto buffer = std::make_shared<TaskTraceBuffer>();
+        std::lock_guard<std::mutex> lock(registry.mtx_);
+        buffer->tid_ = registry.nextTid_++;
+        buffer->epoch_.store(registry.epoch_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        registry.buffers_.push_back(buffer);
+        localTrace_.buffer_ = std::move(buffer);
+    }
+    TaskTraceBuffer& buffer = *localTrace_.buffer_;
+    uint32_t epoch = registry.epoch_.load(std::memory_order_acquire);
+    if (buffer.epoch_.load(std::memory_order_relaxed) != epoch)
+    {
+        buffer.size_.store(0, std::memory_order_relaxed);
+        buffer.dropped_.store(0, std::memory_order_relaxed);
+        buffer.epoch_.store(epoch, std::memory_order_release);
+    }
+    return buffer;
+}
+
+// 记录一个事件
+void TaskTrace::record(TraceEventType type, const void* pool, uint64_t id)
+{
+    TaskTraceBuffer& buffer = localTraceBuffer();
+    size_t size = buffer.size_.load(std::memory_order_relaxed);
+    if (size >= TaskTraceBuffer::CAPACITY)
+    {
+        buffer.dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    TaskTraceEvent& event = buffer.events_[size];
+    event.time_ = traceClock();
+    event.id_ = id;
+    event.pool_ = pool;
+    event.type_ = type;
+    buffer.size_.store(size + 1, std::memory_order_release);
+}
+
+// 给提交的任务分配编号：高位是线程的轨道编号，低位是线程内的计数
+uint64_t TaskTrace::nextId()
+{
+    TaskTraceBuffer& buffer = localTraceBuffer();
+    return (static_cast<uint64_t>(buffer.tid_ + 1) << 40) | ++buffer.nextId_;
+}
+
+// 开始一次新的记录
+void TaskTrace::start()
+{
+    TaskTraceRegistry& registry = traceRegistry();
+    std::lock_guard<std::mutex> lock(registry.mtx_);
+    auto& buffers = registry.buffers_;
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [](const std::shared_ptr<TaskTraceBuffer>& buffer) {
+        return !buffer->alive_.load(std::memory_order_relaxed);
+    }), buffers.end());
+    registry.epoch_.fetch_add(1, std::memory_order_release);
+    registry.startNs_ = steadyNowNs();
+    registry.startClock_ = traceClock();
+    registry.stopClock_ = 0;
+    enabled_.store(true, std::memory_order_release);
+}
+
+// 停止记录
+void TaskTrace::stop()
+{
+    TaskTraceRegistry& registry = traceRegistry();
+    std::lock_guard<std::mutex> lock(registry.mtx_);
+    if (!enabled_.exchange(false, std::memory_order_acq_rel)) return;
+    registry.stopClock_ = traceClock();
+    registry.stopNs_ = steadyNowNs();
+}
+
+// 事件类型对应的名称
+static const char* traceEventName(TraceEventType type)
+{
+    switch (type)
+    {
+    case TraceEventType::TRACE_SUBMIT: return "submit";
+    case TraceEventType::TRACE_DEQUEUE: return "dequeue";
+    case TraceEventType::TRACE_START:
+    case TraceEventType::TRACE_END: return "task";
+    case TraceEventType::TRACE_STEAL: return "steal";
+    case TraceEventType::TRACE_SPAWN: return "spawn";
+    case TraceEventType::TRACE_REAP: return "reap";
+    case TraceEventType::TRACE_PARK: return "park";
+    case TraceEventType::TRACE_ACTIVATE: return "activate";
+    case TraceEventType::TRACE_COMPENSATE: return "compensate";
+    }
+    return "unknown";
+}
+
+// 导出为Chrome trace JSON
+bool TaskTrace::writeChromeTrace(std::ostream& out)
+{
+    TaskTraceRegistry& registry = traceRegistry();
+    std::lock_guard<std::mutex> lock(registry.mtx_);
+    uint32_t epoch = registry.epoch_.load(std::memory_order_relaxed);
+    // 时间戳计数器换算为微秒：还没有stop()时按当前时间换算
+    uint64_t stopClock = registry.stopClock_ != 0 ? registry.stopClock_ : traceClock();
+    int64_t stopNs = registry.stopClock_ != 0 ? registry.stopNs_ : steadyNowNs();
+    double nsPerTick = stopClock > registry.startClock_
+        ? static_cast<double>(stopNs - registry.startNs_) / static_cast<double>(stopClock - registry.startClock_) : 1.0;
+    auto toUs = [&](uint64_t time) {
+        return time > registry.startClock_ ? static_cast<double>(time - registry.startClock_) * nsPerTick / 1000.0 : 0.0;
+    };
+
+    // 本次记录的缓冲区，以及所有任务的提交时间(计算排队时间、连接提交和开始执行)
+    std::vector<std::pair<TaskTraceBuffer*, size_t>> buffers;
+    std::unordered_map<uint64_t, uint64_t> submitTime;
+    std::unordered_map<const void*, int> pids;
+    for (auto& buffer : registry.buffers_)
+    {
+        if (buffer->epoch_.load(std::memory_order_acquire) != epoch) continue;
+        size_t size = buffer->size_.load(std::memory_order_acquire);
+        buffers.emplace_back(buffer.get(), size);
+        for (size_t i = 0; i < size; i++)
+        {
+            const TaskTraceEvent& event = buffer->events_[i];
+            if (event.type_ == TraceEventType::TRACE_SUBMIT) submitTime.emplace(event.id_, event.time_);
+            pids.emplace(event.pool_, static_cast<int>(pids.size()) + 1);
+        }
+    }
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    auto begin = [&](const char* ph, const char* name, int pid, int tid, double ts) -> std::ostream& {
+        out << (first ? "" : ",\n") << "{\"ph\":\"" << ph << "\",\"name\":\"" << name << "\",\"pid\":" << pid
+            << ",\"tid\":" << tid << ",\"ts\":" << ts;
+        first = false;
+        return out;
+    };
+    out << std::fixed;
+    out.precision(3);
+    for (auto& item : pids)
+    {
+        begin("M", "process_name", item.second, 0, 0.0) << ",\"args\":{\"name\":\"ThreadPool " << item.second << "\"}}";
+    }
+    for (auto& item : buffers)
+    {
+        TaskTraceBuffer& buffer = *item.first;
+        int tid = buffer.tid_ + 1;
+        std::vector<const void*> named; // 已经输出过线程名的线程池
+        std::vector<const TaskTraceEvent*> running; // 还没有结束的任务，帮忙执行的任务嵌套在等待它的任务中
+        for (size_t i = 0; i < item.second; i++)
+        {
+            const TaskTraceEvent& event = buffer.events_[i];
+            int pid = pids[event.pool_];
+            if (std::find(named.begin(), named.end(), event.pool_) == named.end())
+            {
+                named.push_back(event.pool_);
+                begin("M", "thread_name", pid, tid, 0.0) << ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+            }
+            const char* name = traceEventName(event.type_);
+            switch (event.type_)
+            {
+            case TraceEventType::TRACE_START:
+                running.push_back(&event);
+                break;
+            case TraceEventType::TRACE_END:
+            {
+                if (running.empty()) break;
+                const TaskTraceEvent& start = *running.back();
+                running.pop_back();
+                double ts = toUs(start.time_);
+                auto submit = start.id_ != 0 ? submitTime.find(start.id_) : submitTime.end();
+                begin("X", name, pid, tid, ts) << ",\"dur\":" << toUs(event.time_) - ts
+                    << ",\"args\":{\"id\":" << start.id_;
+                if (submit != submitTime.end())
+                {
+                    out << ",\"wait_us\":" << ts - toUs(submit->second);
+                }
+                out << "}}";
+                // 连接提交和开始执行的箭头的终点
+                if (submit != submitTime.end())
+                {
+                    begin("f", "queue", pid, tid, ts) << ",\"cat\":\"task\",\"bp\":\"e\",\"id\":" << start.id_ << "}";
+                }
+                break;
+            }
+            case TraceEventType::TRACE_SUBMIT:
+                begin("i", name, pid, tid, toUs(event.time_)) << ",\"s\":\"t\",\"args\":{\"id\":" << event.id_ << "}}";
+                begin("s", "queue", pid, tid, toUs(event.time_)) << ",\"cat\":\"task\",\"id\":" << event.id_ << "}";
+                break;
+            default:
+                begin("i", name, pid, tid, toUs(event.time_)) << ",\"s\":\"t\",\"args\":{\"id\":" << event.id_ << "}}";
+                break;
+            }
+        }
+        // stop()时还没有结束的任务画到记录结束的时间
+        for (const TaskTraceEvent* start : running)
+        {
+            double ts = toUs(start->time_);
+            begin("X", "task", pids[start->pool_], tid, ts) << ",\"dur\":" << toUs(stopClock) - ts
+                << ",\"args\":{\"id\":" << start->id_ << ",\"unfinished\":true}}";
+        }
+        uint64_t dropped = buffer.dropped_.load(std::memory_order_relaxed);
+        if (dropped > 0 && !named.empty())
+        {
+            begin("i", "dropped", pids[named.front()], tid, toUs(stopClock)) << ",\"s\":\"t\",\"args\":{\"count\":"
+                << dropped << "}}";
+        }
+    }
+    out << "\n]}\n";
+    out.unsetf(std::ios::floatfield);
+    return true;
+}
+#else
+// 没有编译跟踪功能：不记录，导出空的事件列表
+void TaskTrace::start() {}
+void TaskTrace::stop() {}
+bool TaskTrace::writeChromeTrace(std::ostream& out)
+{
+    out << "{\"traceEvents\":[]}\n";
+    return false;
+}
+#endif
+/*************************完成通知类方法实现*************************/
+#if !defined(__cpp_lib_atomic_wait) && defined(__linux__)
+// C++17下没有atomic::wait，Linux上直接在状态字上使用futex
+static inline void futexWait(std::atomic_int& word, int expected)
+{
+    syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+static inline void futexWakeAll(std::atomic_int& word)
+{
+    syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+#elif !defined(__cpp_lib_atomic_wait)
+// 按地址散列的全局等待表，所有Completion共享，等待的线程用对象地址找到对应的互斥锁和条件变量
+struct ParkingBucket
+{
+    std::mutex mtx_;
+    std::condition_variable cond_;
+};
+
+static ParkingBucket& parkingBucket(const void* addr)
+{
+    static ParkingBucket buckets[64];
+    return buckets[(reinterpret_cast<uintptr_t>(addr) >> 4) % 64];
+}
+#endif
+
+// 设置为完成状态，有线程在等待时才去唤醒
+void Completion::set()
+{
+    if (state_.exchange(STATE_DONE, std::memory_order_acq_rel) != STATE_WAITING) return;
+#if defined(__cpp_lib_atomic_wait)
+    state_.notify_all();
+#elif defined(__linux__)
+    // 等待线程返回后Completion可能已被析构，futex只按地址唤醒，不会访问已释放的内存
+    futexWakeAll(state_);
+#else
+    // 只用到对象地址，等待线程返回后即使Completion已被析构也不会访问已释放的内存
+    ParkingBucket& bucket = parkingBucket(this);
+    std::lock_guard<std::mutex> lock(bucket.mtx_);
+    bucket.cond_.notify_all();
+#endif
+}
+
+// 阻塞直到完成
+void Completion::wait()
+{
+    int state = state_.load(std::memory_order_acquire);
+    if (state == STATE_DONE) return;
+    // 登记有线程在等待，set()看到STATE_WAITING才需要唤醒
+    if (state == STATE_EMPTY
+        && !state_.compare_exchange_strong(state, STATE_WAITING, std::memory_order_acq_rel)
+        && state == STATE_DONE)
+    {
+        return;
+    }
+#if defined(__cpp_lib_atomic_wait)
+    while (state_.load(std::memory_order_acquire) != STATE_DONE)
+    {
+        state_.wait(STATE_WAITING, std::memory_order_acquire);
+    }
+#elif defined(__linux__)
+    // 状态已经不是STATE_WAITING时futex立即返回，被提前唤醒时重新检查
+    while (state_.load(std::memory_order_acquire) != STATE_DONE)
+    {
+        futexWait(state_, STATE_WAITING);
+    }
+#else
+    ParkingBucket& bucket = parkingBucket(this);
+    std::unique_lock<std::mutex> lock(bucket.mtx_);
+    bucket.cond_.wait(lock, [&]()->bool { return state_.load(std::memory_order_acquire) == STATE_DONE; });
+#endif
+}
+/*************************任务类方法实现*************************/
+// 提交结果的说明文字
+const char* submitStatusText(SubmitStatus status)
+{
+    switch (status)
+    {
+    case SubmitStatus::SUBMIT_OK: return "task submitted.";
+    case SubmitStatus::SUBMIT_SPILLED: return "task spilled to the overflow queue.";
+    case SubmitStatus::SUBMIT_CALLER_RAN: return "task ran in the submitting thread.";
+    case SubmitStatus::SUBMIT_QUEUE_FULL:
+    case SubmitStatus::SUBMIT_TIMEOUT: return "task queue is full, submit task fail.";
+    case SubmitStatus::SUBMIT_DROPPED: return "task was dropped from the full task queue.";
+    case SubmitStatus::SUBMIT_CANCELED: return "task was canceled before execution.";
+    case SubmitStatus::SUBMIT_EXPIRED: return "task deadline expired before execution.";
+    case SubmitStatus::SUBMIT_SHUTDOWN: return "thread pool is shut down.";
+    }
+    return "unknown submit status.";
+}
+
+// 构造
+Task::Task() {}
+
+// 释放没有执行的回调(任务没有执行完就被销毁)
+Task::~Task()
+{
+    CallbackNode* node = callbacks_.load(std::memory_order_relaxed);
+    while (node != nullptr && node != finishedMark())
+    {
+        CallbackNode* next = node->next_;
+        delete node;
+        node = next;
+    }
+}
+// 执行任务并把任务的返回值通过setVal()保存下来，通知Result
+void Task::exec()
+{
+    // 多态调用
+    setVal(run());
+}
+
+// 任务被挤出任务队列，没有执行，以空的返回值通知Result
+void Task::discard()
+{
+    setVal(Any());
+}
+
+// 线程池线程获取任务执行完的返回值记录在any_中，并通过信号量通知用户线程任务执行完成
+void Task::setVal(Any&& any)
+{
+    // 存储task的返回值
+    this->any_ = std::move(any);
+    // 先执行回调再通知Result，回调可能取走返回值，之后get()得到空的Any
+    // 没有登记回调时只有一次原子交换，不需要加锁
+    CallbackNode* node = callbacks_.exchange(finishedMark(), std::memory_order_acq_rel);
+    // 链表是按登记的相反顺序组成的，先反转，按登记顺序执行
+    CallbackNode* ordered = nullptr;
+    while (node != nullptr)
+    {
+        CallbackNode* next = node->next_;
+        node->next_ = ordered;
+        ordered = node;
+        node = next;
+    }
+    while (ordered != nullptr)
+    {
+        CallbackNode* next = ordered->next_;
+        ordered->callback_(*this);
+        delete ordered;
+        ordered = next;
+    }
+    // 已经获取任务的返回值，通知等待的线程
+    done_.set();
+}
+
+// 登记任务执行完后执行的回调，任务已经执行完时在当前线程立即执行
+void Task::addCallback(std::function<void(Task&)> callback)
+{
+    CallbackNode* node = new CallbackNode{ std::move(callback), callbacks_.load(std::memory_order_acquire) };
+    while (node->next_ != finishedMark())
+    {
+        if (callbacks_.compare_exchange_weak(node->next_, node, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            return;
+        }
+    }
+    node->callback_(*this);
+    delete node;
+}
+
+/*************************Result类方法实现*************************/
+// 阻塞直到这一批任务全部执行完，等待期间帮忙执行线程池中的其他任务
+void BatchResult::wait()
+{
+    if (state_->isReady()) return;
+    BatchState* state = state_.get();
+    if (pool_ == nullptr)
+    {
+        state->wait();
+        return;
+    }
+    pool_->helpWait(nullptr, [state]() { return state->isReady(); }, [state]() { state->wait(); });
+}
+
+// 构造
+Result::Result(std::shared_ptr<Task> task, bool isValid, ThreadPool* pool)
+    : task_(task)
+    , isValid_(isValid)
+    , pool_(pool)
+{}
+
+// 移动构造
+Result::Result(Result&& other) noexcept
+    : task_(std::move(other.task_))
+    , isValid_(other.isValid_.exchange(false))
+    , pool_(other.pool_)
+{}
+
+// 移动赋值
+Result& Result::operator=(Result&& other) noexcept
+{
+    if (this != &other)
+    {
+        task_ = std::move(other.task_);
+        isValid_ = other.isValid_.exchange(false);
+        pool_ = other.pool_;
+    }
+    return *this;
+}
+
+// 用户调用该方法获取task的返回值
+Any Result::get()
+{
+        // 没有提交成功：返回空的Any，调用者通过status()区分原因
+        if(!isValid_) return Any();
+        //任务如果没有执行完，帮忙执行其他任务，没有可以帮忙的任务时阻塞用户线程
+        // 已经完成时只有一次原子读
+        if (!task_->done_.isSet())
+        {
+            Task* task = task_.get();
+            if (pool_ == nullptr)
+            {
+                task->done_.wait();
+            }
+            else
+            {
+                pool_->helpWait(task_, [task]() { return task->done_.isSet(); }, [task]() { task->done_.wait(); });
+            }
+        }
+        return std::move(task_->any_);
+}
+
+// 提交结果
+SubmitStatus Result::status() const
+{
+    return task_->submitStatus();
+}
+
+// 取消任务
+bool Result::cancel()
+{
+    if (!isValid_ || pool_ == nullptr) return false;
+    return pool_->cancelTask(task_);
+}
+
+// 由回调设置返回值的任务，whenAll()/whenAny()用它作为合并结果，不会被线程池执行
+class PromiseTask : public Task
+{
+public:
+    Any run() override { return Any(); }
+};
+
+// 所有Result都有返回值后完成
+Result whenAll(const std::vector<Result*>& results)
+{
+    struct WhenAllState
+    {
+        std::atomic<size_t> pending_;
+        std::vector<Any> values_;
+        std::shared_ptr<Task> combined_;
+    };
+    auto combined = makeTask<PromiseTask>();
+    // 合并结果的then()提交到第一个有效Result所属的线程池
+    ThreadPool* pool = nullptr;
+    for (Result* result : results)
+    {
+        if (result->isValid_ && pool == nullptr) pool = result->pool_;
+    }
+    if (results.empty())
+    {
+        combined->setVal(std::vector<Any>());
+        return Result(combined, true, pool);
+    }
+
+    auto state = std::make_shared<WhenAllState>();
+    state->pending_.store(results.size(), std::memory_order_relaxed);
+    state->values_.resize(results.size());
+    state->combined_ = combined;
+    // 最后一个完成的任务设置合并结果，acq_rel保证它能看到其他任务写入的返回值
+    auto finish = [state](size_t index, Any value) {
+        state->values_[index] = std::move(value);
+        if (state->pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            state->combined_->setVal(std::move(state->values_));
+        }
+    };
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        Result* result = results[i];
+        if (!result->isValid_)
+        {
+            // 提交失败的任务不会执行，对应的返回值为空
+            finish(i, Any());
+            continue;
+        }
+        result->task_->addCallback([finish, i](Task& task) { finish(i, task.takeVal()); });
+    }
+    return Result(combined, true, pool);
+}
+
+// 任意一个Result有返回值后完成
+Result whenAny(const std::vector<Result*>& results)
+{
+    struct WhenAnyState
+    {
+        std::atomic_bool done_{false};
+        std::shared_ptr<Task> combined_;
+    };
+    auto combined = makeTask<PromiseTask>();
+    ThreadPool* pool = nullptr;
+    bool hasValid = false;
+    for (Result* result : results)
+    {
+        if (result->isValid_ && !hasValid)
+        {
+            pool = result->pool_;
+            hasValid = true;
+        }
+    }
+    // 没有可以等待的任务
+    if (!hasValid)
+    {
+        return Result(combined, false, pool);
+    }
+
+    auto state = std::make_shared<WhenAnyState>();
+    state->combined_ = combined;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        Result* result = results[i];
+        if (!result->isValid_) continue;
+        // 只有第一个完成的任务取走返回值，其余任务的返回值留给它们自己的Result
+        result->task_->addCallback([state, i](Task& task) {
+            if (!state->done_.exchange(true, std::memory_order_acq_rel))
+            {
+                state->combined_->setVal(WhenAnyResult{ i, task.takeVal() });
+            }
+        });
+    }
+    return Result(combined, true, pool);
 }
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <memory>
 #include <atomic>
 #include <mutex>
@@ -16,15 +17,87 @@
 #include <functional>
 #include <condition_variable>
 #include <unordered_map>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <exception>
+#include <stdexcept>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+#include <new>
+#include <cstddef>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+// 任务内存池：按64字节分级的线程本地空闲链表，用于Task、FuncTask和BatchState的分配
+// 每个线程先从自己的空闲链表取内存块，为空时从全局链表成批取回，本地链表过长时成批归还全局链表
+// 内存块由其他线程释放也没有问题，只是进入释放线程的本地链表
+class TaskMemoryPool
+{
+public:
+    static const size_t BLOCK_ALIGN = 64;     // 内存块大小按64字节分级
+    static const size_t MAX_BLOCK_SIZE = 512; // 超过该大小的请求直接使用operator new
+    static const int CLASS_SIZE = static_cast<int>(MAX_BLOCK_SIZE / BLOCK_ALIGN);
+
+    static void* allocate(size_t size);
+    static void deallocate(void* p, size_t size);
+};
+
+// 使用TaskMemoryPool的分配器，配合std::allocate_shared把控制块和对象放在同一个内存块里
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        if (n != 1 || alignof(T) > alignof(std::max_align_t))
+        {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(TaskMemoryPool::allocate(sizeof(T)));
+    }
+    void deallocate(T* p, size_t n)
+    {
+        if (n != 1 || alignof(T) > alignof(std::max_align_t))
+        {
+            ::operator delete(p);
+            return;
+        }
+        TaskMemoryPool::deallocate(p, sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+// 用任务内存池创建任务对象，用法和std::make_shared相同：pool.submitTask(makeTask<MyTask>(args...))
+template<typename T, typename... Args>
+std::shared_ptr<T> makeTask(Args&&... args)
+{
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
 
 // Any类型：可以接收任意数据类型
+// 不超过ANY_BUFFER_SIZE的数据直接保存在Any内部的缓冲区中，不在堆上分配
+const size_t ANY_BUFFER_SIZE = 3 * sizeof(void*);
 class Any
 {
 public:
     // 默认构造
     Any() = default;
-    // 默认析构
-    ~Any() = default;
+    // 析构
+    ~Any() { reset(); }
 
     // 禁止左值引用拷贝
     Any(const Any&) = delete;
@@ -32,26 +105,60 @@ public:
     Any& operator=(const Any&) = delete;
 
     //允许右值引用的拷贝
-    Any(Any&&) = default;
+    Any(Any&& other) noexcept { moveFrom(other); }
     //允许右值引用的赋值
-    Any& operator=(Any&&) = default;
+    Any& operator=(Any&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
 
-    // 接受任意数据的构造
+private:
+    template<typename T>
+    struct IsInPlaceType : std::false_type {};
     template<typename T>
-    Any(T data) : base_(std::make_unique<Derive<T>>(data)) {}
+    struct IsInPlaceType<std::in_place_type_t<T>> : std::true_type {};
+
+public:
+    // 接受任意数据的构造，右值直接移动进来(包括run()中return的局部变量)，左值拷贝一次
+    template<typename T, typename = std::enable_if_t<
+        !std::is_same_v<std::decay_t<T>, Any> && !IsInPlaceType<std::decay_t<T>>::value>>
+    Any(T&& data)
+    {
+        construct<std::decay_t<T>>(std::forward<T>(data));
+    }
+    // 用参数原地构造T的对象，不经过临时对象：return Any(std::in_place_type<std::vector<int>>, n, 0);
+    template<typename T, typename... Args>
+    explicit Any(std::in_place_type_t<T>, Args&&... args)
+    {
+        construct<T>(std::forward<Args>(args)...);
+    }
 
-    // 把Any对象里存储的data数据提取出来
+    // 销毁原来的数据，用参数原地构造T的对象，返回新对象的引用
+    template<typename T, typename... Args>
+    T& emplace(Args&&... args)
+    {
+        reset();
+        construct<T>(std::forward<Args>(args)...);
+        return static_cast<Derive<T>*>(base_)->data_;
+    }
+
+    // 把Any对象里存储的data数据提取出来：T为值类型时拷贝一份，T为引用类型(cast_<T&>())时返回内部数据的引用
     template<typename T>
-    T cast_()
+    T cast_() &
     {
-        // 如何从base_里面找到它指向的派生类对象 从它里面取出data变量?
-        // 基类指针强制转成派生类指针 RTTI类型识别
-        Derive<T> *pd = dynamic_cast<Derive<T>*>(base_.get());
-        if (pd == nullptr)
-        {
-            throw "type is unmatch!";
-        }
-        return pd->data_;
+        return derive<std::remove_cv_t<std::remove_reference_t<T>>>()->data_;
+    }
+    // 临时的Any对象(例如res.get().cast_<T>())或std::move(any).cast_<T>()直接把数据移动出来，T可以是只能移动的类型
+    template<typename T>
+    T cast_() &&
+    {
+        static_assert(!std::is_lvalue_reference_v<T>, "cast_<T&>() on a temporary Any would dangle");
+        return std::move(derive<std::remove_cv_t<std::remove_reference_t<T>>>()->data_);
     }
 private:
     // 基类类型
@@ -59,50 +166,376 @@ private:
     {
     public:
         virtual ~Base() = default; // 需要使用虚函数
+        // 把数据移动到另一个Any的缓冲区中，返回新对象
+        virtual Base* moveTo(void* buffer) = 0;
     };
     // 派生类类型
     template<typename T>
     class Derive : public Base
     {
     public:
-        Derive(T data) : data_(data) {}
+        template<typename... Args>
+        explicit Derive(Args&&... args) : data_(std::forward<Args>(args)...) {}
+        Base* moveTo(void* buffer) override { return new (buffer) Derive(std::move(data_)); }
         T data_; // 保存了其他类型
     };
+
+    template<typename T>
+    Derive<T>* derive()
+    {
+        // 如何从base_里面找到它指向的派生类对象 从它里面取出data变量?
+        // 基类指针强制转成派生类指针 RTTI类型识别
+        Derive<T> *pd = dynamic_cast<Derive<T>*>(base_);
+        if (pd == nullptr)
+        {
+            throw "type is unmatch!";
+        }
+        return pd;
+    }
+
+    // 用参数构造T的对象，放得进缓冲区时构造在缓冲区中
+    template<typename T, typename... Args>
+    void construct(Args&&... args)
+    {
+        if constexpr (isLocal<T>())
+        {
+            base_ = new (buffer_) Derive<T>(std::forward<Args>(args)...);
+            local_ = true;
+        }
+        else
+        {
+            base_ = new Derive<T>(std::forward<Args>(args)...);
+        }
+    }
+
+    // 放得进缓冲区并且移动不抛异常的类型保存在缓冲区中
+    template<typename T>
+    static constexpr bool isLocal()
+    {
+        return sizeof(Derive<T>) <= sizeof(buffer_)
+            && alignof(Derive<T>) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<T>::value;
+    }
+
+    // 接管other中的数据，other变为空
+    void moveFrom(Any& other)
+    {
+        if (other.local_)
+        {
+            base_ = other.base_->moveTo(buffer_);
+            local_ = true;
+            other.reset();
+        }
+        else
+        {
+            base_ = other.base_;
+            other.base_ = nullptr;
+        }
+    }
+
+    // 销毁保存的数据
+    void reset()
+    {
+        if (local_)
+        {
+            base_->~Base();
+        }
+        else
+        {
+            delete base_;
+        }
+        base_ = nullptr;
+        local_ = false;
+    }
 private:
-    // 定义一个基类的指针，可以指向派生类对象
-    std::unique_ptr<Base> base_;
+    // 定义一个基类的指针，可以指向派生类对象，数据在缓冲区中时指向buffer_
+    Base* base_ = nullptr;
+    bool local_ = false; // 数据是否保存在buffer_中
+    alignas(std::max_align_t) unsigned char buffer_[sizeof(void*) + ANY_BUFFER_SIZE];
+};
+
+// 调试跟踪：默认编译为空操作，没有任何开销
+// 编译时定义THREADPOOL_TRACE后，每条记录只写入当前线程私有的无锁环形缓冲区，由后台线程异步输出到std::cout
+// msg必须是字符串字面量(只保存指针)，arg为附带的整数参数
+#ifdef THREADPOOL_TRACE
+struct TraceRecord
+{
+    uint64_t time_; // steady_clock时间戳，单位：纳秒
+    uint64_t arg_;
+    const char* msg_;
 };
 
-// 实现Semaphore类
-class Semaphore
+class Tracer
 {
 public:
-    // 构造
-    Semaphore(int resLimit = 0) : resLimit_(resLimit) {}
+    // 记录一条跟踪信息
+    static void record(const char* msg, uint64_t arg = 0);
+    // 立即输出所有线程缓冲区中的记录
+    static void flush();
+};
+#define TP_TRACE(...) Tracer::record(__VA_ARGS__)
+#else
+#define TP_TRACE(...) ((void)0)
+#endif
 
-    // 析构
-    ~Semaphore() = default;
+// 调度事件类型
+enum class TraceEventType : uint32_t
+{
+    TRACE_SUBMIT,     // 任务放入队列(提交线程)
+    TRACE_DEQUEUE,    // 线程池线程从队列取出任务
+    TRACE_START,      // 开始执行任务
+    TRACE_END,        // 任务执行结束
+    TRACE_STEAL,      // MODE_STEALING下从其他线程的队列窃取任务
+    TRACE_SPAWN,      // 创建线程
+    TRACE_REAP,       // 线程被回收或阻塞结束后退出
+    TRACE_PARK,       // 线程进入保留线程池休眠
+    TRACE_ACTIVATE,   // 唤醒保留线程
+    TRACE_COMPENSATE, // 线程进入阻塞区域，补偿一个线程
+};
+
+// 调度事件跟踪：记录提交、取出、开始/结束执行、窃取和线程的创建/回收等事件，导出为Chrome trace JSON
+// (chrome://tracing和Perfetto UI都可以打开)，用于分析线程函数的调度问题
+// 编译时定义THREADPOOL_PROFILE才记录，否则TP_EVENT编译为空操作，start()/stop()什么也不做，导出空的事件列表
+// 运行时start()之后才记录：每个事件只用时间戳计数器(x86下为rdtsc)取时间，写入当前线程私有的缓冲区，不加锁；
+// 缓冲区满时丢弃之后的事件。导出时把时间戳换算为微秒，每个线程池是一个进程(pid)，每个线程是一条轨道(tid)，
+// 任务的执行画成区间，提交和开始执行之间用箭头连接。导出应在stop()之后进行
+class TaskTrace
+{
+public:
+    // 开始一次新的记录，清空之前的事件
+    static void start();
+    // 停止记录
+    static void stop();
+    // 把本次记录的事件以Chrome trace JSON格式写入out，返回是否编译了跟踪功能
+    static bool writeChromeTrace(std::ostream& out);
+
+#ifdef THREADPOOL_PROFILE
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+    // 记录一个事件：pool为所属线程池，id为任务编号或线程id
+    static void record(TraceEventType type, const void* pool, uint64_t id);
+    // 给提交的任务分配编号，当前线程内递增，不需要共享的计数器
+    static uint64_t nextId();
+
+private:
+    static std::atomic_bool enabled_;
+#endif
+};
+#ifdef THREADPOOL_PROFILE
+#define TP_EVENT(type, pool, id) \
+    do { if (TaskTrace::enabled()) TaskTrace::record(TraceEventType::type, pool, id); } while (0)
+#else
+#define TP_EVENT(type, pool, id) ((void)0)
+#endif
+
+// 一次性完成通知：用一个原子状态字记录是否完成，已完成时wait()只需要一次原子读
+// 未完成时用atomic::wait(C++20)或futex(Linux)在状态字上等待，其他平台在按对象地址散列的全局互斥锁/条件变量表上等待，
+// 不需要每个任务都带一对互斥锁和条件变量
+class Completion
+{
+public:
+    Completion() : state_(STATE_EMPTY) {}
+
+    Completion(const Completion&) = delete;
+    Completion& operator=(const Completion&) = delete;
+
+    // 是否已经完成
+    bool isSet() const { return state_.load(std::memory_order_acquire) == STATE_DONE; }
+    // 设置为完成状态，有线程在等待时才去唤醒
+    void set();
+    // 阻塞直到完成
+    void wait();
+
+private:
+    enum { STATE_EMPTY = 0, STATE_WAITING = 1, STATE_DONE = 2 };
+    std::atomic_int state_;
+};
+
+// 一批任务的共享完成计数，批量提交的任务执行完后递减，减到0时通知等待的线程
+class BatchState
+{
+public:
+    explicit BatchState(size_t pending) : pending_(pending)
+    {
+        if (pending == 0) done_.set();
+    }
+    // n个任务执行完成(或没有提交成功)
+    void finish(size_t n = 1)
+    {
+        if (n > 0 && pending_.fetch_sub(n, std::memory_order_acq_rel) == n) done_.set();
+    }
+    bool isReady() const { return done_.isSet(); }
+    void wait() { done_.wait(); }
+
+private:
+    std::atomic<size_t> pending_;
+    Completion done_;
+};
+
+// 任务优先级
+enum class TaskPriority
+{
+    PRIORITY_HIGH,   // 高优先级，例如交互请求
+    PRIORITY_NORMAL, // 默认优先级
+    PRIORITY_LOW,    // 低优先级，例如后台压缩
+};
+const int TASK_PRIORITY_SIZE = 3; // 优先级数量
+
+// 提交任务的结果，Result::status()/TaskFuture::status()返回，任务队列满时调用方可以据此立即降级而不必等待
+enum class SubmitStatus
+{
+    SUBMIT_OK,         // 放入任务队列
+    SUBMIT_SPILLED,    // 任务队列满，放入不限长度的溢出队列(OVERFLOW_SPILL)
+    SUBMIT_CALLER_RAN, // 任务队列满，已经在提交线程中执行完(OVERFLOW_CALLER_RUNS)
+    SUBMIT_QUEUE_FULL, // 任务队列满，没有提交(trySubmit或OVERFLOW_REJECT)
+    SUBMIT_TIMEOUT,    // 等到截止时间任务队列仍然是满的，没有提交(submitUntil或OVERFLOW_BLOCK)
+    SUBMIT_DROPPED,    // 已经提交，但在执行前被后来的任务挤出任务队列(OVERFLOW_DROP_OLDEST)
+    SUBMIT_CANCELED,   // 在开始执行前被取消
+    SUBMIT_EXPIRED,    // 超过截止时间还没有开始执行，不再执行
+    SUBMIT_SHUTDOWN,   // 线程池已经关闭，没有提交；shutdown()返回的没有执行的任务也是这个状态
+};
+
+// 提交结果的说明文字，TaskFuture::get()抛出的异常使用
+const char* submitStatusText(SubmitStatus status);
+
+// submitTask()遇到任务队列满时的处理方式
+enum class OverflowPolicy
+{
+    OVERFLOW_BLOCK,       // 阻塞等待任务队列有空余，最长等待setSubmitTimeout()设置的时间(默认1s)
+    OVERFLOW_REJECT,      // 立即返回SUBMIT_QUEUE_FULL
+    OVERFLOW_CALLER_RUNS, // 在提交线程中直接执行任务，提交线程自然被减速
+    OVERFLOW_DROP_OLDEST, // 丢弃任务队列中等待最久的任务，被丢弃任务的Result/TaskFuture状态变为SUBMIT_DROPPED
+    OVERFLOW_SPILL,       // 放入不限长度的溢出队列，任务队列有空余时按顺序移回
+};
+
+// 取消标记：可以复制，所有副本共享同一个状态，一个标记可以关联多个任务
+// cancel()之后，关联的任务中还没有开始执行的不再执行，已经开始执行的任务可以在run()中调用isCanceled()自行结束
+class CancelToken
+{
+public:
+    // 默认构造的标记为空，不会被取消，不需要分配内存
+    CancelToken() = default;
+    // 创建一个可以取消的标记
+    static CancelToken create()
+    {
+        CancelToken token;
+        token.state_ = std::make_shared<std::atomic_bool>(false);
+        return token;
+    }
 
-    // 获取一个信号量资源
-    void acquire_()
+    void cancel() const
+    {
+        if (state_ != nullptr) state_->store(true, std::memory_order_release);
+    }
+    bool isCanceled() const
     {
-        std::unique_lock<std::mutex> lock(mtx_);
-        //等待信号量有资源，没有资源就阻塞当前线程
-        cond_.wait(lock, [&]()->bool { return resLimit_>0;});
-        resLimit_--;
+        return state_ != nullptr && state_->load(std::memory_order_acquire);
     }
 
-    // 释放一个信号量资源
-    void release_()
+private:
+    std::shared_ptr<std::atomic_bool> state_;
+};
+
+// 提交任务时的可选参数
+struct TaskOptions
+{
+    TaskPriority priority = TaskPriority::PRIORITY_NORMAL;
+    CancelToken token; // 取消标记，默认不关联
+    // 执行截止时间：线程取出任务时已经超过截止时间就不再执行，状态变为SUBMIT_EXPIRED，默认不限制
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    // 阻塞任务(同步磁盘、网络IO)：执行期间线程池临时增加一个补偿线程，相当于整个任务在BlockingRegion中执行
+    bool blocking = false;
+};
+
+// 线程池任务队列中保存的任务基类，线程池只通过exec()执行任务
+class TaskBase
+{
+public:
+    virtual ~TaskBase() = default;
+    // 执行任务
+    virtual void exec() = 0;
+    // 任务没有执行就被丢弃(OVERFLOW_DROP_OLDEST)，通知等待结果的线程
+    virtual void discard() {}
+    // 提交结果，被丢弃的任务在丢弃之后变为SUBMIT_DROPPED，取消或过期后变为SUBMIT_CANCELED/SUBMIT_EXPIRED
+    SubmitStatus submitStatus() const { return submitStatus_.load(std::memory_order_acquire); }
+    // 任务是否已经被取消(Result::cancel()或关联的CancelToken)，执行时间长的任务可以在执行中检查
+    bool isCanceled() const
     {
-        std::unique_lock<std::mutex> lock(mtx_);
-        resLimit_++;
-        cond_.notify_all();
+        return canceled_.load(std::memory_order_acquire) || cancelToken_.isCanceled();
     }
+
+private:
+    friend class ThreadPool;
+    friend class PriorityTaskQueue;
+    friend class StrandState;
+    friend class TimerWheel;
+    friend class GroupScheduler;
+    std::shared_ptr<BatchState> batch_; // 批量提交时所属的批次，单个提交时为空
+    TaskPriority priority_ = TaskPriority::PRIORITY_NORMAL; // 提交时指定的优先级
+    int numaNode_ = -1; // 提交时指定的NUMA节点，-1表示不指定
+    std::chrono::steady_clock::time_point enqueueTime_; // 进入任务队列的时间
+    // 执行权：入队时设为TASK_QUEUED，从队列取出执行或被等待的线程直接执行时改为TASK_CLAIMED，
+    // 保证任务只执行一次；已经被直接执行的任务之后从队列中取出时跳过
+    // submitAfter()的任务在时间轮中等待到期时为TASK_DELAYED，只能被cancel()取得执行权，等待的线程不会提前执行
+    enum { TASK_CREATED = 0, TASK_QUEUED = 1, TASK_CLAIMED = 2, TASK_DELAYED = 3 };
+    std::atomic_int runState_{TASK_CREATED};
+    std::atomic<SubmitStatus> submitStatus_{SubmitStatus::SUBMIT_OK};
+    std::atomic_bool canceled_{false}; // Result::cancel()/TaskFuture::cancel()设置
+    CancelToken cancelToken_; // 提交时关联的取消标记
+    std::chrono::steady_clock::time_point deadline_ = std::chrono::steady_clock::time_point::max(); // 执行截止时间
+    bool blocking_ = false; // 提交时声明为阻塞任务
+#ifdef THREADPOOL_PROFILE
+    uint64_t traceId_ = 0; // 调度事件跟踪中的任务编号，跟踪开启后提交的任务才有
+#endif
+};
+
+// 按优先级分道的任务队列(QUE_LOCKED模式下的taskQue_)
+// 每个优先级一个FIFO队列，出队时先取高优先级；开启老化后，低优先级队头等待超过老化时间的任务优先出队，避免饿死
+// 所有操作都需要在持有taskQueMtx_时进行
+class PriorityTaskQueue
+{
+public:
+    PriorityTaskQueue();
+    // 所有优先级的任务总数
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    // 某个优先级的任务数
+    size_t size(TaskPriority priority) const { return lanes_[static_cast<int>(priority)].size(); }
+    // 按任务的优先级入队
+    void push(std::shared_ptr<TaskBase> task);
+    // 取出下一个要执行的任务，队列不能为空
+    std::shared_ptr<TaskBase> pop();
+    // 取出某个优先级队列中等待最久的任务，该队列不能为空
+    std::shared_ptr<TaskBase> popFront(TaskPriority priority);
+    // 设置老化时间，0表示不老化(严格按优先级)
+    void setAging(std::chrono::steady_clock::duration aging) { aging_ = aging; }
+
+private:
+    std::queue<std::shared_ptr<TaskBase>> lanes_[TASK_PRIORITY_SIZE];
+    size_t size_;
+    std::chrono::steady_clock::duration aging_;
+};
+
+class ThreadPool;
+// submitBatch()返回的一批任务的整体句柄，不为每个任务创建Result
+class BatchResult
+{
+public:
+    BatchResult(std::shared_ptr<BatchState> state, size_t size, ThreadPool* pool = nullptr)
+        : state_(std::move(state))
+        , size_(size)
+        , pool_(pool)
+    {}
+    // 成功提交的任务数量，任务队列满超时后剩下的任务不会被提交
+    size_t size() const { return size_; }
+    // 这一批任务是否全部执行完
+    bool isReady() const { return state_->isReady(); }
+    // 阻塞直到这一批任务全部执行完，等待期间帮忙执行线程池中的其他任务
+    void wait();
+
 private:
-    int resLimit_; // 资源计数
-    std::mutex mtx_;
-    std::condition_variable cond_;
+    std::shared_ptr<BatchState> state_;
+    size_t size_;
+    ThreadPool* pool_; // 提交任务的线程池
 };
 
 //Task类型的前置声明
@@ -112,37 +545,261 @@ class Result
 {
 public:
     // 构造
-    Result(std::shared_ptr<Task> task, bool isValid = true);
+    Result(std::shared_ptr<Task> task, bool isValid = true, ThreadPool* pool = nullptr);
     // 析构
     ~Result() = default;
-    // 获取任务执行完的返回值记录在any_中，并通过信号量通知其他线程任务执行完成
-    void setVal(Any any);
+    // 允许移动，可以直接放入std::vector<Result>
+    Result(Result&& other) noexcept;
+    Result& operator=(Result&& other) noexcept;
     // 用户调用该方法获取task的返回值
+    // 任务没有执行完时，等待的线程帮忙执行线程池中的其他任务，线程池的线程嵌套等待子任务不会死锁
     Any get();
+    // 提交结果，没有提交成功(SUBMIT_QUEUE_FULL/SUBMIT_TIMEOUT)时get()返回空的Any
+    SubmitStatus status() const;
+    // 取消任务：还没有开始执行的任务不再执行，get()立即返回空的Any，返回是否在执行前取消成功
+    // 已经开始执行的任务继续执行，run()中可以通过isCanceled()检查
+    bool cancel();
+
+    // 任务执行完后把返回值交给func(Any)，func作为新任务提交到同一个线程池，返回新任务的Result
+    // 返回值只能取一次，调用then()之后不要再调用get()；线程池析构之后不要再调用then()
+    template<typename F>
+    Result then(F&& func);
+
+    // co_await result的等待对象(C++20)：任务没有执行完时挂起协程，不阻塞线程，执行完后在线程池线程上恢复
+    // co_await的结果和get()一样是任务的返回值(Any)，返回值只能取一次
+    class Awaiter
+    {
+    public:
+        explicit Awaiter(Result& result) : result_(result) {}
+        bool await_ready() const;
+        template<typename Handle>
+        void await_suspend(Handle handle);
+        Any await_resume() { return resumed_ ? std::move(value_) : result_.get(); }
+
+    private:
+        Result& result_;
+        Any value_; // 任务执行完后由回调取走的返回值
+        bool resumed_ = false; // 是否由回调恢复
+    };
 
 private:
-    Any any_; // 存储任务的返回值
-    Semaphore sem_; // 线程通信信号量
-    std::shared_ptr<Task> task_; //指向获取任务返回值的任务对象
+    friend Result whenAll(const std::vector<Result*>& results);
+    friend Result whenAny(const std::vector<Result*>& results);
+
+    std::shared_ptr<Task> task_; //指向获取任务返回值的任务对象，返回值和完成通知保存在task对象中
     std::atomic_bool isValid_; // 返回值是否有效
+    ThreadPool* pool_; // 提交任务的线程池，then()的后续任务提交到这里
+};
+
+// 所有Result都有返回值后完成，返回值为std::vector<Any>，按参数顺序保存每个任务的返回值
+// 等待的过程不占用任何线程：最后一个完成的任务在setVal()时设置合并后的返回值
+Result whenAll(const std::vector<Result*>& results);
+template<typename... Rs>
+Result whenAll(Result& first, Rs&... rest)
+{
+    return whenAll(std::vector<Result*>{ &first, &rest... });
+}
+
+// whenAny的返回值：第一个完成的任务的下标和它的返回值
+struct WhenAnyResult
+{
+    size_t index_;
+    Any value_;
 };
 
+// 任意一个Result有返回值后完成，返回值为WhenAnyResult，其余任务的返回值仍保留在各自的Result中
+Result whenAny(const std::vector<Result*>& results);
+template<typename... Rs>
+Result whenAny(Result& first, Rs&... rest)
+{
+    return whenAny(std::vector<Result*>{ &first, &rest... });
+}
+
 // 任务抽象基类
-class Task
+class Task : public TaskBase
 {
 public:
     Task();
-    ~Task() = default;
+    ~Task();
     // 用户可以自定义任意任务类型，从Task继承，重写run方法，实现自定义任务处理
     virtual Any run() = 0;
-    // 执行任务并把任务的返回值通过srtVal()给到Result
-    void exec();
-    // 设置Result
-    void setResult(Result* res);
+    // 执行任务并把任务的返回值通过setVal()保存下来，通知Result
+    void exec() override;
+    // 任务被丢弃，以空的返回值通知Result
+    void discard() override;
+private:
+    friend class Result;
+    friend Result whenAll(const std::vector<Result*>& results);
+    friend Result whenAny(const std::vector<Result*>& results);
+    // 获取任务执行完的返回值记录在any_中，执行登记的回调，并通过完成通知唤醒等待的线程
+    void setVal(Any&& any);
+    // 登记任务执行完后在setVal()中执行的回调，任务已经执行完时在当前线程立即执行
+    void addCallback(std::function<void(Task&)> callback);
+    // 取出返回值，供回调使用
+    Any takeVal() { return std::move(any_); }
+
+    // 返回值不再由Result对象保存、再由Task回填Result指针：
+    // Result是在任务入队之后才构造的，任务可能在回填指针之前就已经被执行完，返回值丢失导致get()永远阻塞；
+    // 用户丢弃Result时指针也会悬空。Result通过task_延长Task的生命周期，直接从这里取返回值
+    Any any_; // 存储任务的返回值
+    Completion done_; // 任务执行完的通知，已经完成时get()只需要一次原子读
+
+    // then()/whenAll()/whenAny()登记的回调，按登记的相反顺序组成无锁链表
+    struct CallbackNode
+    {
+        std::function<void(Task&)> callback_;
+        CallbackNode* next_;
+    };
+    // 链表头，setVal()取走链表后换成finishedMark()，之后登记的回调直接执行
+    std::atomic<CallbackNode*> callbacks_{nullptr};
+    static CallbackNode* finishedMark() { return reinterpret_cast<CallbackNode*>(static_cast<uintptr_t>(1)); }
+};
+
+// then()创建的后续任务：run()时把前一个任务的返回值交给用户的可调用对象
+template<typename F>
+class ContinuationTask : public Task
+{
+public:
+    explicit ContinuationTask(F&& func) : func_(std::move(func)) {}
+    Any run() override
+    {
+        using R = std::invoke_result_t<F&, Any>;
+        if constexpr (std::is_void_v<R>)
+        {
+            func_(std::move(input_));
+            return Any();
+        }
+        else
+        {
+            return Any(func_(std::move(input_)));
+        }
+    }
+
 private:
-    // 不能用智能指针，会造成强智能指针的交叉引用问题，导致指针无法释放造成内存泄漏
-    // Result对象的生命周期大于Task的，因此不用担心指针没了
-    Result* result_; 
+    friend class Result;
+    F func_;
+    Any input_; // 前一个任务的返回值
+};
+
+// 类型化任务的共享状态：返回值槽位 + 完成通知，不经过Any，不需要RTTI
+template<typename R>
+class FutureState : public TaskBase
+{
+public:
+    // 任务是否已经执行完
+    bool isReady() const { return done_.isSet(); }
+    // 阻塞直到任务执行完
+    void wait() { done_.wait(); }
+    // 阻塞直到任务执行完，取出返回值(只能取一次)，任务抛出的异常在这里重新抛出
+    R get()
+    {
+        done_.wait();
+        if (exception_) std::rethrow_exception(exception_);
+        if constexpr (!std::is_void_v<R>)
+            return std::move(*value_);
+    }
+    // 任务没有执行就结束了(例如提交失败)，记录异常并通知等待的线程
+    void fail(std::exception_ptr e)
+    {
+        exception_ = e;
+        done_.set();
+    }
+    // 任务被丢弃、取消或过期，get()抛出异常
+    void discard() override
+    {
+        fail(std::make_exception_ptr(std::runtime_error(submitStatusText(this->submitStatus()))));
+    }
+
+protected:
+    // 执行可调用对象并保存返回值
+    template<typename F>
+    void complete(F& func)
+    {
+        try
+        {
+            if constexpr (std::is_void_v<R>)
+                func();
+            else
+                value_.emplace(func());
+        }
+        catch (...)
+        {
+            exception_ = std::current_exception();
+        }
+        done_.set();
+    }
+
+private:
+    using ValueType = std::conditional_t<std::is_void_v<R>, char, R>;
+    std::optional<ValueType> value_; // 返回值槽位
+    std::exception_ptr exception_;
+    Completion done_;
+};
+
+// 绑定了参数的可调用对象和它的返回值槽位放在同一个对象里，由一次allocate_shared从任务内存池分配
+template<typename R, typename F>
+class FuncTask : public FutureState<R>
+{
+public:
+    explicit FuncTask(F&& func) : func_(std::move(func)) {}
+    void exec() override { this->complete(func_); }
+
+private:
+    F func_;
+};
+
+// 类型化任务的返回值句柄，代替Result + Any
+template<typename R>
+class TaskFuture
+{
+public:
+    TaskFuture() = default;
+    explicit TaskFuture(std::shared_ptr<FutureState<R>> state, ThreadPool* pool = nullptr)
+        : state_(std::move(state))
+        , pool_(pool)
+    {}
+
+    // 是否关联了任务
+    bool valid() const { return state_ != nullptr; }
+    // 提交结果，没有提交成功时get()抛出异常
+    SubmitStatus status() const { return state_->submitStatus(); }
+    // 取消任务，还没有开始执行的任务不再执行，get()抛出异常，返回是否在执行前取消成功
+    bool cancel();
+    // 任务是否已经执行完
+    bool isReady() const { return state_->isReady(); }
+    // 阻塞直到任务执行完，等待期间帮忙执行线程池中的其他任务
+    void wait() const;
+    // 获取任务的返回值，任务没有执行完时阻塞
+    R get()
+    {
+        wait();
+        return state_->get();
+    }
+
+private:
+    std::shared_ptr<FutureState<R>> state_;
+    ThreadPool* pool_ = nullptr; // 提交任务的线程池
+};
+
+// 恢复协程的任务(C++20)：线程池线程执行时恢复协程
+// 没有执行就被丢弃(任务队列满时被挤掉、线程池关闭后被discard()等)时记录状态再恢复，由等待对象决定如何处理
+// 不关心提交结果的等待对象(返回值已经取走)传入nullptr
+// 协程句柄类型作为模板参数，头文件按C++17编译时不需要<coroutine>
+template<typename Handle>
+class ResumeTask : public TaskBase
+{
+public:
+    ResumeTask(Handle handle, SubmitStatus* status) : handle_(handle), status_(status) {}
+    void exec() override { handle_.resume(); }
+    void discard() override
+    {
+        if (status_ != nullptr) *status_ = submitStatus();
+        handle_.resume();
+    }
+
+private:
+    Handle handle_;
+    SubmitStatus* status_; // 等待对象(在协程帧中)保存的提交结果，可以为nullptr
 };
 
 // 线程池支持类型
@@ -150,6 +807,246 @@ enum class PoolMode
 {
     MODE_FIXED,  // 固定数量的线程
     MODE_CACHED, // 线程数量可动态增长
+    MODE_STEALING, // 固定数量的线程，每个线程拥有自己的任务队列，空闲时从其他线程窃取任务
+};
+
+// 工作窃取模式下每个线程私有的任务双端队列
+// 所属线程在队尾压入/弹出(LIFO，缓存局部性好)，其他线程从队头窃取(FIFO，窃取最早提交的任务)
+class WorkStealingQueue
+{
+public:
+    // 所属线程从队尾压入任务
+    void push(std::shared_ptr<TaskBase> task);
+    // 所属线程从队尾弹出任务
+    bool pop(std::shared_ptr<TaskBase>& task);
+    // 其他线程从队头窃取任务
+    bool steal(std::shared_ptr<TaskBase>& task);
+
+private:
+    std::deque<std::shared_ptr<TaskBase>> que_;
+    std::mutex mtx_; // 只在所属线程和窃取线程之间竞争，不再争抢全局的taskQueMtx_
+};
+
+// 任务队列实现方式
+enum class TaskQueMode
+{
+    QUE_LOCKED,   // std::queue + taskQueMtx_ + 条件变量
+    QUE_LOCKFREE, // 无锁有界环形队列，只有队列满/空时才退化为条件变量阻塞
+};
+
+// 无锁有界多生产者多消费者环形队列(Vyukov算法)
+// 每个槽位带一个序号，生产者/消费者通过CAS抢占入队/出队位置，再通过槽位序号判断槽位是否可用
+// 容量向上取整为2的幂，下标用位与代替取模
+template<typename T>
+class MpmcRingQueue
+{
+public:
+    explicit MpmcRingQueue(size_t capacity)
+        : enqueuePos_(0)
+        , dequeuePos_(0)
+    {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++)
+        {
+            cells_[i].seq_.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcRingQueue(const MpmcRingQueue&) = delete;
+    MpmcRingQueue& operator=(const MpmcRingQueue&) = delete;
+
+    // 入队，队列满时返回false且不会移走data
+    bool push(T& data)
+    {
+        Cell* cell;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq_.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                // 槽位空闲，抢占入队位置
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+            {
+                return false; // 槽位还没被消费，队列已满
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data_ = std::move(data);
+        cell->seq_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 出队，队列空时返回false
+    bool pop(T& data)
+    {
+        Cell* cell;
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq_.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0)
+            {
+                // 槽位已写入数据，抢占出队位置
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+            {
+                return false; // 槽位还没被写入，队列为空
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        data = std::move(cell->data_);
+        // 序号推进一圈，表示槽位可以被下一轮生产者使用
+        cell->seq_.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列容量
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq_;
+        T data_;
+    };
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    // 入队、出队位置分别被生产者和消费者修改，放在不同的缓存行避免伪共享
+    alignas(64) std::atomic<size_t> enqueuePos_;
+    alignas(64) std::atomic<size_t> dequeuePos_;
+};
+
+// 线程空闲等待策略：任务队列为空时先自旋等待新任务，超过自旋次数再进入条件变量等待
+// 自旋可以省掉一次睡眠/唤醒的系统调用，降低任务派发延迟，代价是空闲时多消耗一些CPU
+struct IdlePolicy
+{
+    int spinCount = 0;        // 自旋次数(自适应时为初始值)，0表示直接进入条件变量等待
+    bool adaptive = false;    // 是否根据任务到达情况自动调整自旋次数
+    int minSpinCount = 16;    // 自适应时自旋次数的下限
+    int maxSpinCount = 16384; // 自适应时自旋次数的上限
+};
+
+// MODE_CACHED的弹性伸缩策略，由弹性控制线程定期检查任务排队延迟：
+// 排队延迟连续growAfterTicks次超过targetLatency才创建线程；持续idleTimeout时间延迟都低于targetLatency的一半，
+// 并且一直有空闲线程时，才回收这段时间内始终空闲的线程，避免突发负载下线程成批创建又成批回收
+struct ElasticPolicy
+{
+    std::chrono::microseconds targetLatency{1000}; // 任务排队延迟目标
+    int growAfterTicks = 2;                        // 连续超过目标多少次检查才扩容
+    int maxGrowStep = 4;                           // 每次检查最多创建的线程数
+    std::chrono::microseconds checkInterval{1000}; // 有任务排队时的检查周期
+    std::chrono::milliseconds idleTimeout{10000};  // 多余线程持续空闲多久后回收
+    int reserveThreads = 0;                        // 保留线程数：回收的线程先进入保留线程池休眠，扩容时直接唤醒，不创建系统线程
+};
+
+// 线程池关闭方式
+enum class ShutdownMode
+{
+    SHUTDOWN_DRAIN,          // 执行完任务队列中的所有任务再关闭(析构函数的行为)
+    SHUTDOWN_CANCEL_PENDING, // 不再执行任务队列中的任务，等正在执行的任务结束后关闭
+};
+
+// 线程绑核方式
+enum class AffinityMode
+{
+    AFFINITY_NONE,     // 不绑核，由操作系统调度(默认)
+    AFFINITY_COMPACT,  // 按CPU编号依次绑定，相邻线程共享缓存
+    AFFINITY_SCATTER,  // 轮流绑定到不同NUMA节点的CPU上，分散内存带宽压力
+    AFFINITY_CPU_LIST, // 按用户给出的CPU列表依次绑定
+    AFFINITY_NUMA,     // 线程按NUMA节点分组，每组线程可以在本节点的所有CPU上运行
+};
+
+// 线程绑核策略
+struct AffinityPolicy
+{
+    AffinityMode mode = AffinityMode::AFFINITY_NONE;
+    std::vector<int> cpus; // AFFINITY_CPU_LIST模式下的CPU编号列表
+};
+
+// CPU拓扑：每个NUMA节点上可用的CPU编号，只包含当前进程允许使用的CPU
+struct CpuTopology
+{
+    std::vector<std::vector<int>> nodes_;
+
+    // 读取系统的CPU拓扑(Linux下读取/sys/devices/system/node)，读取失败时视为一个节点
+    static CpuTopology detect();
+    // CPU所在的NUMA节点，找不到返回-1
+    int nodeOf(int cpu) const;
+};
+
+// 对数分桶的耗时直方图，第i个桶统计[2^i, 2^(i+1))纳秒，最后一个桶包含更长的耗时
+const int LATENCY_BUCKET_SIZE = 32;
+struct LatencyHistogram
+{
+    uint64_t buckets_[LATENCY_BUCKET_SIZE] = {};
+
+    // 样本总数
+    uint64_t count() const;
+    // 百分位数(p取0~1)所在桶的上界，单位：纳秒，没有样本时返回0
+    uint64_t percentile(double p) const;
+};
+
+// 线程池统计信息快照
+struct PoolStats
+{
+    uint64_t submitted = 0;       // 提交成功的任务数
+    uint64_t rejected = 0;        // 任务队列满提交失败的任务数
+    uint64_t completed = 0;       // 执行完的任务数
+    uint64_t steals = 0;          // MODE_STEALING下从其他线程窃取的任务数
+    uint64_t threadSpawns = 0;    // MODE_CACHED下新创建的线程数
+    uint64_t threadReaps = 0;     // MODE_CACHED下空闲超时回收的线程数(包括进入保留线程池休眠的)
+    uint64_t threadActivations = 0; // MODE_CACHED下扩容时从保留线程池唤醒的线程数
+    uint64_t compensations = 0;   // 线程进入阻塞区域时增加补偿线程的次数
+    uint64_t submitBlockedNs = 0; // 提交线程因任务队列满而阻塞的总时间，单位：纳秒
+    uint64_t callerRuns = 0;      // 任务队列满时在提交线程中执行的任务数
+    uint64_t dropped = 0;         // 任务队列满时被挤出任务队列的任务数
+    uint64_t spilled = 0;         // 任务队列满时放入溢出队列的任务数
+    size_t queueDepth = 0;        // 当前排队的任务数
+    uint64_t canceled = 0;        // 在执行前被取消、没有执行的任务数
+    uint64_t expired = 0;         // 超过执行截止时间、没有执行的任务数
+    size_t overflowDepth = 0;     // 当前溢出队列中的任务数
+    int idleThreads = 0;          // 当前空闲线程数
+    int curThreads = 0;           // 当前线程总数(不包括保留线程池中休眠的线程)
+    int reserveThreads = 0;       // MODE_CACHED下保留线程池中休眠的线程数
+    int blockingThreads = 0;      // 当前在阻塞区域中的线程数
+    LatencyHistogram waitTime;    // 任务从入队到开始执行的耗时
+    LatencyHistogram runTime;     // 任务的执行耗时
+};
+
+// 每个线程私有的统计计数，单独占用缓存行，只有所属线程写入，stats()读取时汇总
+struct alignas(64) WorkerStats
+{
+    WorkerStats();
+    // 记录一个任务的排队耗时和执行耗时
+    void record(uint64_t waitNs, uint64_t runNs);
+
+    std::atomic<uint64_t> completed_;
+    std::atomic<uint64_t> steals_;
+    std::atomic_int busy_; // 线程正在执行任务为1，空闲为0，ThreadPool::idleThreads()读取时汇总
+    // MODE_CACHED：弹性控制线程检查时汇总
+    std::atomic<uint64_t> maxWaitNs_; // 上次检查以来开始执行的任务中最长的排队时间
+    std::atomic<int64_t> lastDequeueNs_; // 最近一次有任务开始执行的时间(steady_clock纳秒)
+    std::atomic<uint64_t> waitTime_[LATENCY_BUCKET_SIZE];
+    std::atomic<uint64_t> runTime_[LATENCY_BUCKET_SIZE];
 };
 
 // 线程类型
@@ -168,11 +1065,31 @@ public:
     // 启动线程
     void start();
 
+    // 等待线程函数返回，不能在线程自己的线程函数中调用
+    void join();
+
+    // 设置线程允许运行的CPU，需要在start()之前调用，为空表示不绑核
+    void setAffinity(std::vector<int> cpus);
+
+    // 设置线程栈大小(字节)，需要在start()之前调用，0表示系统默认值；只在Linux下生效
+    void setStackSize(size_t bytes);
+
+    // 执行线程函数，由线程入口调用
+    void run();
+
     // 获取线程ID
 	int getId() const;
 
 private:
     ThreadFunc func_;
+    std::thread thread_; // 不再detach()，线程池关闭时join()，关闭耗时可以预期
+    std::vector<int> cpus_; // 线程绑定的CPU
+    size_t stackSize_ = 0; // 线程栈大小，0表示系统默认值
+#ifdef __linux__
+    // 指定了栈大小时std::thread无法设置，直接用pthread_create()创建
+    pthread_t nativeThread_{};
+    bool nativeStarted_ = false;
+#endif
     static int generatedId_;
     int threadId_;
 };
@@ -189,7 +1106,40 @@ public:
 };
 
 pool.submitTask(std::make_shared<MyTask>());
+pool.submitTask(makeTask<MyTask>()); // 从任务内存池分配
 */
+// 执行器组的公平调度器，在threadpool.cpp中实现
+class GroupScheduler;
+
+// 定时器：分层时间轮和挂在上面的定时器，在threadpool.cpp中实现
+class TimerWheel;
+struct TimerEntry;
+
+// submitEvery()返回的周期任务句柄，拷贝的句柄指向同一个周期任务
+class TimerHandle
+{
+public:
+    TimerHandle() = default;
+    explicit TimerHandle(std::shared_ptr<TimerEntry> entry) : entry_(std::move(entry)) {}
+
+    // 是否关联了周期任务
+    bool valid() const { return entry_ != nullptr; }
+    // 取消周期任务：从时间轮中摘下(O(1))，之后不再提交，已经提交的那一次照常执行
+    // 返回是否由这次调用取消(之前没有被取消，线程池也没有关闭)
+    bool cancel();
+
+private:
+    std::shared_ptr<TimerEntry> entry_;
+};
+
+// ThreadPool中频繁修改的共享计数和任务队列各自按缓存行对齐
+// 编译时定义THREADPOOL_PACKED_LAYOUT后不对齐，这些成员紧挨着存放，只用于基准测试对比对齐前后的扩展性
+#ifdef THREADPOOL_PACKED_LAYOUT
+#define TP_CACHELINE_ALIGN
+#else
+#define TP_CACHELINE_ALIGN alignas(64)
+#endif
+
 // 线程池类型
 class ThreadPool
 {
@@ -206,15 +1156,340 @@ public:
     // 设置任务队列最大阈值
     void setTaskQueMaxThreshold(int threshold);
 
-    // 设置线程池cached模式下线程阈值
+    // 设置任务队列实现方式，QUE_LOCKFREE模式下容量为taskQueMaxThreshold_向上取整的2的幂
+    void setTaskQueMode(TaskQueMode mode);
+
+    // 设置线程池cached模式下线程阈值，也是各模式下阻塞补偿线程的上限
     void setThreadSizeThreshold(int threshold);
 
+    // 设置线程空闲等待策略
+    void setIdlePolicy(const IdlePolicy& policy);
+
+    // 设置工作线程的栈大小(字节)，0表示系统默认值；只在Linux下生效，大量线程时可以减小栈占用的内存
+    void setThreadStackSize(size_t bytes);
+
+    // 设置MODE_CACHED的弹性伸缩策略，线程池运行中也可以修改，下一次检查时生效
+    void setElasticPolicy(const ElasticPolicy& policy);
+
+    // 设置某个优先级队列的最大任务数量，0表示只受taskQueMaxThreshold_限制
+    void setLaneMaxThreshold(TaskPriority priority, int threshold);
+
+    // 设置优先级老化时间：低优先级任务等待超过该时间后优先执行，0表示严格按优先级
+    void setPriorityAging(std::chrono::milliseconds aging);
+
+    // 设置submitTask()遇到任务队列满时的处理方式，默认OVERFLOW_BLOCK
+    void setOverflowPolicy(OverflowPolicy policy);
+
+    // 设置OVERFLOW_BLOCK和submitBatch()等待任务队列有空余的最长时间，默认1s
+    void setSubmitTimeout(std::chrono::milliseconds timeout);
+
     // 给线程池提交任务
-    Result submitTask(std::shared_ptr<Task> task);
+    // 优先级只对共享任务队列(QUE_LOCKED)生效；QUE_LOCKFREE的环形队列和MODE_STEALING线程私有队列按提交顺序执行
+    Result submitTask(std::shared_ptr<Task> task, TaskPriority priority = TaskPriority::PRIORITY_NORMAL);
+
+    // 按提交选项提交任务：优先级、取消标记和执行截止时间
+    Result submitTask(std::shared_ptr<Task> task, const TaskOptions& options);
+
+    // 批量提交任务：整批任务只加一次锁，只唤醒和新任务数量相同的空闲线程，返回整批任务的句柄
+    // [begin, end)的元素类型为std::shared_ptr<Task>或其派生类的智能指针
+    template<typename Iter>
+    BatchResult submitBatch(Iter begin, Iter end, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        std::vector<std::shared_ptr<TaskBase>> tasks(begin, end);
+        return enqueueBatch(tasks, priority);
+    }
+
+    // 给线程池提交任意可调用对象和参数，返回类型化的TaskFuture
+    // 可调用对象、参数和返回值槽位在一次分配中完成，不经过Any，也没有每个任务一对的互斥锁和条件变量
+    // pool.submitTask(sum, 1, 100).get();
+    template<typename F, typename... Args>
+    auto submitTask(F&& func, Args&&... args)
+        -> TaskFuture<std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    {
+        return submitTask(TaskPriority::PRIORITY_NORMAL, std::forward<F>(func), std::forward<Args>(args)...);
+    }
+
+    // 按指定优先级提交任意可调用对象和参数
+    // pool.submitTask(TaskPriority::PRIORITY_HIGH, sum, 1, 100).get();
+    template<typename F, typename... Args>
+    auto submitTask(TaskPriority priority, F&& func, Args&&... args)
+        -> TaskFuture<std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    {
+        auto task = makeFuncTask(std::forward<F>(func), std::forward<Args>(args)...);
+        task->priority_ = priority;
+        return submitFuncTask(std::move(task));
+    }
+
+    // 按提交选项提交任意可调用对象和参数
+    // pool.submitTask(TaskOptions{ TaskPriority::PRIORITY_NORMAL, token, deadline }, sum, 1, 100)
+    template<typename F, typename... Args>
+    auto submitTask(const TaskOptions& options, F&& func, Args&&... args)
+        -> TaskFuture<std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    {
+        auto task = makeFuncTask(std::forward<F>(func), std::forward<Args>(args)...);
+        applyOptions(*task, options);
+        return submitFuncTask(std::move(task));
+    }
+
+    // 提交任务，从不阻塞：任务队列满时不按溢出策略处理，立即返回状态为SUBMIT_QUEUE_FULL的Result
+    Result trySubmit(std::shared_ptr<Task> task, TaskPriority priority = TaskPriority::PRIORITY_NORMAL);
+
+    // 提交任意可调用对象和参数，从不阻塞，任务队列满时返回状态为SUBMIT_QUEUE_FULL的TaskFuture
+    template<typename F, typename... Args>
+    auto trySubmit(F&& func, Args&&... args)
+        -> TaskFuture<std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    {
+        auto task = makeFuncTask(std::forward<F>(func), std::forward<Args>(args)...);
+        return submitFuncTask(std::move(task), OverflowPolicy::OVERFLOW_REJECT);
+    }
+
+    // 提交任务，任务队列满时最多等待到deadline，仍然是满的返回状态为SUBMIT_TIMEOUT的Result
+    Result submitUntil(std::chrono::steady_clock::time_point deadline, std::shared_ptr<Task> task,
+        TaskPriority priority = TaskPriority::PRIORITY_NORMAL);
+
+    // 提交任意可调用对象和参数，任务队列满时最多等待到deadline
+    template<typename F, typename... Args>
+    auto submitUntil(std::chrono::steady_clock::time_point deadline, F&& func, Args&&... args)
+        -> TaskFuture<std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    {
+        auto task = makeFuncTask(std::forward<F>(func), std::forward<Args>(args)...);
+        return submitFuncTask(std::move(task), OverflowPolicy::OVERFLOW_BLOCK, deadline);
+    }
+
+    // 延迟delay之后提交任务，到期之前Result::cancel()可以取消，到期时任务队列满也不阻塞定时线程(放入溢出队列)
+    // 定时器由分层时间轮管理，精度为1ms，插入和取消都是O(1)，第一次使用时启动定时线程
+    Result submitAfter(std::chrono::milliseconds delay, std::shared_ptr<Task> task,
+        TaskPriority priority = TaskPriority::PRIORITY_NORMAL);
+
+    // 延迟delay之后提交任意可调用对象和参数
+    // pool.submitAfter(std::chrono::milliseconds(100), sum, 1, 100).get();
+    template<typename F, typename... Args>
+    auto submitAfter(std::chrono::milliseconds delay, F&& func, Args&&... args)
+        -> TaskFuture<std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    {
+        using R = std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
+        auto task = makeFuncTask(std::forward<F>(func), std::forward<Args>(args)...);
+        SubmitStatus status = scheduleTimer(task, delay);
+        if (!isAccepted(status))
+        {
+            task->fail(std::make_exception_ptr(std::runtime_error(submitStatusText(status))));
+        }
+        return TaskFuture<R>(std::move(task), this);
+    }
+
+    // 每隔period提交一次func(args...)，第一次在period之后，返回值被忽略，执行中抛出的异常输出到std::cerr
+    // 按固定频率提交：上一次还没有执行完时跳过这一次，不会同时执行；可调用对象需要能拷贝(保存在std::function中)
+    // 通过返回的TimerHandle取消，线程池关闭时自动停止
+    template<typename F, typename... Args>
+    TimerHandle submitEvery(std::chrono::milliseconds period, F&& func, Args&&... args)
+    {
+        return scheduleEvery(period, [func = std::forward<F>(func),
+                                      args = std::make_tuple(std::forward<Args>(args)...)]() mutable
+        {
+            std::apply(func, args);
+        });
+    }
+
+    // co_await pool.schedule()的等待对象(C++20)：挂起协程，把恢复协程的任务放入任务队列，由线程池线程恢复
+    class ScheduleAwaiter
+    {
+    public:
+        ScheduleAwaiter(ThreadPool* pool, TaskPriority priority) : pool_(pool), priority_(priority) {}
+        bool await_ready() const { return false; }
+        template<typename Handle>
+        bool await_suspend(Handle handle)
+        {
+            auto task = makeTask<ResumeTask<Handle>>(handle, &status_);
+            task->priority_ = priority_;
+            // OVERFLOW_CALLER_RUNS会在await_suspend()中直接恢复协程，之后的代码就不在线程池线程上执行了，
+            // 改为放入溢出队列，和定时器到期提交一样不在当前线程执行
+            OverflowPolicy policy = pool_->overflowPolicy_ == OverflowPolicy::OVERFLOW_CALLER_RUNS
+                ? OverflowPolicy::OVERFLOW_SPILL : pool_->overflowPolicy_;
+            SubmitStatus status = pool_->enqueueTask(task, policy);
+            // 提交成功后协程可能已经在线程池线程上恢复，不能再访问this
+            if (isAccepted(status)) return true;
+            // 没有提交成功：不挂起，await_resume()抛出异常
+            status_ = status;
+            return false;
+        }
+        // 没有提交成功或恢复任务被丢弃时抛出异常，此时协程不在线程池线程上
+        void await_resume() const
+        {
+            if (status_ != SubmitStatus::SUBMIT_OK) throw std::runtime_error(submitStatusText(status_));
+        }
+
+    private:
+        ThreadPool* pool_;
+        TaskPriority priority_;
+        SubmitStatus status_ = SubmitStatus::SUBMIT_OK;
+    };
+    // 协程中co_await pool.schedule()：之后的代码在线程池线程上执行，恢复任务和其他任务一样排队，按priority出队
+    ScheduleAwaiter schedule(TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        return ScheduleAwaiter(this, priority);
+    }
+
+    // 关闭线程池：之后线程池以外的线程提交任务返回SUBMIT_SHUTDOWN，等所有线程退出并join()后返回
+    // 返回任务队列中没有执行的任务(SHUTDOWN_DRAIN时只有还没有到期的submitAfter()任务)，这些任务已经从队列中移除、状态为SUBMIT_SHUTDOWN，
+    // 不会再被执行，也没有通知等待结果的线程：调用者可以exec()执行、提交到其他线程池，或者discard()通知等待者
+    std::vector<std::shared_ptr<TaskBase>> shutdown(ShutdownMode mode = ShutdownMode::SHUTDOWN_DRAIN);
+    // 关闭线程池：先继续执行任务队列中的任务，到deadline还没有开始执行的任务不再执行，作为返回值返回
+    // 正在执行的任务不会被打断，关闭的耗时为deadline加上正在执行的任务剩余的时间
+    std::vector<std::shared_ptr<TaskBase>> shutdown(std::chrono::steady_clock::time_point deadline);
 
     // 开启线程池，初始化最大线程数量为CPU核心个数
     void start(int initThreadSize = std::thread::hardware_concurrency());
 
+    // 按绑核策略开启线程池
+    void start(int initThreadSize, const AffinityPolicy& policy);
+
+    // 设置线程绑核策略
+    void setAffinity(const AffinityPolicy& policy);
+
+    // NUMA节点数量
+    int numaNodeCount() const;
+
+    // 获取线程池统计信息快照
+    PoolStats stats() const;
+
+    // 等待ready()为true，期间当前线程帮忙执行任务：
+    // 等待的任务awaited还在任务队列中时直接在当前线程执行它，否则从任务队列取出其他任务执行
+    // 没有可以帮忙的任务时调用block()阻塞等待，此时等待的任务已经在某个线程上执行
+    template<typename Ready, typename Block>
+    void helpWait(const std::shared_ptr<TaskBase>& awaited, Ready&& ready, Block&& block)
+    {
+        // ready()可能会取走完成通知，返回true之后不能再次调用
+        if (ready()) return;
+        if (awaited != nullptr)
+        {
+            runInline(awaited);
+        }
+        while (!ready())
+        {
+            if (helpOnce()) continue;
+            if (!canHelp())
+            {
+                block();
+                return;
+            }
+            // 任务计数已经增加但任务还没有放入队列，稍后再取
+            std::this_thread::yield();
+        }
+    }
+
+    // 把任务提交给指定NUMA节点上的线程执行
+    // 只在MODE_STEALING且按AFFINITY_NONE以外的策略绑核时生效，任务放入该节点某个线程的私有队列，其他节点的线程空闲时仍可以窃取
+    // 排队的任务总数达到任务队列阈值时和其他提交一样按溢出策略处理
+    Result submitTaskToNode(int node, std::shared_ptr<Task> task);
+
+    // 把任意可调用对象提交给指定NUMA节点上的线程执行
+    template<typename F, typename... Args>
+    auto submitTaskToNode(int node, F&& func, Args&&... args)
+        -> TaskFuture<std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    {
+        auto task = makeFuncTask(std::forward<F>(func), std::forward<Args>(args)...);
+        task->numaNode_ = node;
+        return submitFuncTask(std::move(task));
+    }
+
+    // 并行算法：把区间切分成块，调用线程和线程池中的线程动态领取块执行，全部执行完才返回
+    // grain为每块的元素个数，为0时按线程数自动选择；块由共享计数器领取，不为每块创建Result
+    // 调用线程自己也领取块，所以在线程池的线程中调用也不会因为线程都在等待而死锁
+    // 任意一块抛出的异常在所有块结束后重新抛出，之后还没开始的块不再执行
+
+    // 对[begin, end)中的每个下标i调用func(i)
+    template<typename Index, typename F>
+    void parallelFor(Index begin, Index end, F&& func, size_t grain = 0)
+    {
+        static_assert(std::is_integral<Index>::value, "parallelFor requires integral index");
+        if (!(begin < end)) return;
+        size_t size = static_cast<size_t>(end - begin);
+        size_t chunkSize = grainSize(size, grain);
+        size_t chunks = (size + chunkSize - 1) / chunkSize;
+        auto body = [&](size_t chunk) {
+            Index first = begin + static_cast<Index>(chunk * chunkSize);
+            Index last = chunk + 1 == chunks ? end : first + static_cast<Index>(chunkSize);
+            for (Index i = first; i < last; i++)
+            {
+                func(i);
+            }
+        };
+        runChunks(chunks, body);
+    }
+
+    // 把[begin, end)切分成块，每块调用func(first, last)得到部分结果，再按块的顺序用combine(T, T)合并
+    // identity为combine的单位元，区间为空时直接返回
+    template<typename T, typename Index, typename F, typename C>
+    T parallelReduce(Index begin, Index end, T identity, F&& func, C&& combine, size_t grain = 0)
+    {
+        static_assert(std::is_integral<Index>::value, "parallelReduce requires integral index");
+        if (!(begin < end)) return identity;
+        size_t size = static_cast<size_t>(end - begin);
+        size_t chunkSize = grainSize(size, grain);
+        size_t chunks = (size + chunkSize - 1) / chunkSize;
+        std::vector<T> partials(chunks, identity);
+        auto body = [&](size_t chunk) {
+            Index first = begin + static_cast<Index>(chunk * chunkSize);
+            Index last = chunk + 1 == chunks ? end : first + static_cast<Index>(chunkSize);
+            partials[chunk] = func(first, last);
+        };
+        runChunks(chunks, body);
+        T result = std::move(identity);
+        for (T& partial : partials)
+        {
+            result = combine(std::move(result), std::move(partial));
+        }
+        return result;
+    }
+
+    // out[i] = op(first[i])，迭代器需要支持随机访问，返回输出区间的结尾
+    template<typename InputIt, typename OutputIt, typename F>
+    OutputIt parallelTransform(InputIt first, InputIt last, OutputIt out, F&& op, size_t grain = 0)
+    {
+        size_t size = static_cast<size_t>(last - first);
+        parallelFor(size_t(0), size, [&](size_t i) { out[i] = op(first[i]); }, grain);
+        return out + size;
+    }
+
+    // 并行排序(不稳定)：每个线程排序一段，再两两归并
+    template<typename RandomIt, typename Compare = std::less<>>
+    void parallelSort(RandomIt first, RandomIt last, Compare comp = Compare())
+    {
+        // 小于该长度的段直接用std::sort，并行的开销大于收益
+        const size_t SORT_GRAIN = 4096;
+        size_t size = static_cast<size_t>(last - first);
+        size_t parts = std::min(static_cast<size_t>(std::max(curThreadSize_.load(), 1)) + 1, size / SORT_GRAIN);
+        if (parts <= 1 || !isPoolRunning_)
+        {
+            std::sort(first, last, comp);
+            return;
+        }
+        std::vector<size_t> bounds(parts + 1);
+        for (size_t i = 0; i <= parts; i++)
+        {
+            bounds[i] = size * i / parts;
+        }
+        auto sortPart = [&](size_t part) {
+            std::sort(first + bounds[part], first + bounds[part + 1], comp);
+        };
+        runChunks(parts, sortPart);
+        // 每轮把相邻的两段归并成一段，共log2(parts)轮
+        for (size_t width = 1; width < parts; width *= 2)
+        {
+            size_t pairs = (parts + 2 * width - 1) / (2 * width);
+            auto mergePair = [&](size_t pair) {
+                size_t lo = pair * 2 * width;
+                size_t mid = std::min(lo + width, parts);
+                size_t hi = std::min(lo + 2 * width, parts);
+                if (mid < hi)
+                {
+                    std::inplace_merge(first + bounds[lo], first + bounds[mid], first + bounds[hi], comp);
+                }
+            };
+            runChunks(pairs, mergePair);
+        }
+    }
+
     // 禁止拷贝构造
     ThreadPool(const ThreadPool&) = delete;
 
@@ -222,29 +1497,517 @@ public:
     ThreadPool& operator=(const ThreadPool&) = delete;
 
 private:
+    // 把可调用对象和参数绑定成FuncTask，可调用对象、参数和返回值槽位在同一次分配中
+    template<typename F, typename... Args>
+    auto makeFuncTask(F&& func, Args&&... args)
+    {
+        using R = std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
+        auto bound = [func = std::forward<F>(func),
+                      args = std::make_tuple(std::forward<Args>(args)...)]() mutable -> R
+        {
+            return std::apply(std::move(func), std::move(args));
+        };
+        return makeTask<FuncTask<R, decltype(bound)>>(std::move(bound));
+    }
+
+    // 提交FuncTask，提交失败时在TaskFuture中记录异常
+    template<typename R, typename F>
+    TaskFuture<R> submitFuncTask(std::shared_ptr<FuncTask<R, F>> task)
+    {
+        return submitFuncTask(std::move(task), overflowPolicy_);
+    }
+    template<typename R, typename F>
+    TaskFuture<R> submitFuncTask(std::shared_ptr<FuncTask<R, F>> task, OverflowPolicy policy,
+        std::chrono::steady_clock::time_point deadline = {})
+    {
+        SubmitStatus status = enqueueTask(task, policy, deadline);
+        if (!isAccepted(status))
+        {
+            task->fail(std::make_exception_ptr(std::runtime_error(submitStatusText(status))));
+        }
+        return TaskFuture<R>(std::move(task), this);
+    }
+
+    // 取出一个其他任务在当前线程执行，没有可以执行的任务时返回false
+    bool helpOnce();
+    // 任务还在任务队列中没有被执行时，取得执行权在当前线程执行
+    void runInline(const std::shared_ptr<TaskBase>& task);
+    // 任务队列中是否还有可以帮忙的任务，嵌套帮忙的层数过深时返回false
+    bool canHelp() const;
+    // 持有taskQueMtx_时从共享任务队列取出一个任务，并通知等待的提交线程
+    std::shared_ptr<TaskBase> takeSharedTask();
+
+    // 并行算法的块大小：指定了grain时使用grain，否则每个线程平均分到约8块
+    size_t grainSize(size_t size, size_t grain) const;
+    // 调用线程和辅助任务一起领取并执行count个块，全部执行完才返回
+    void runParallel(size_t count, void (*invoke)(void*, size_t), void* body);
+    template<typename Body>
+    void runChunks(size_t count, Body& body)
+    {
+        runParallel(count, [](void* ptr, size_t chunk) { (*static_cast<Body*>(ptr))(chunk); }, &body);
+    }
+
+    friend class Result;
+    // 提交then()的后续任务和恢复协程的任务，线程池已经停止或任务队列满时直接在当前线程执行
+    void submitContinuation(const std::shared_ptr<TaskBase>& task);
+
     // 定义线程函数,线程池决定线程执行什么函数，将threadFunc函数用绑定器绑定成函数对象
     void threadFunc(int threadId);
+    // 按绑核策略设置第ordinal个线程运行的CPU，返回线程所在的NUMA节点，不绑核返回-1
+    int assignAffinity(Thread& thread, int ordinal);
     // 检查线程池运行状态
     bool checkRunningState() const;
+    // 把任务放入任务队列并记录统计信息，任务队列满时按policy处理，返回的状态同时记录在任务中
+    // OVERFLOW_BLOCK最多等待到deadline，deadline为默认值时等待submitTimeout_
+    SubmitStatus enqueueTask(const std::shared_ptr<TaskBase>& task, OverflowPolicy policy,
+        std::chrono::steady_clock::time_point deadline = {});
+    // 按线程池模式和任务队列实现方式把任务放入对应的队列，任务队列满时按policy处理(OVERFLOW_CALLER_RUNS只返回状态，由调用者执行)
+    SubmitStatus pushTask(const std::shared_ptr<TaskBase>& task, OverflowPolicy policy,
+        std::chrono::steady_clock::time_point deadline);
+    // 任务是否被线程池接受(放入队列、溢出队列或已经在提交线程执行)
+    static bool isAccepted(SubmitStatus status)
+    {
+        return status == SubmitStatus::SUBMIT_OK || status == SubmitStatus::SUBMIT_SPILLED
+            || status == SubmitStatus::SUBMIT_CALLER_RAN;
+    }
+    // OVERFLOW_DROP_OLDEST：丢弃从任务队列挤出的任务，调用时不能持有taskQueMtx_(丢弃会执行then()的回调)
+    void dropTask(const std::shared_ptr<TaskBase>& task);
+    // 已经取得执行权但不再执行的任务：记录状态并通知等待结果的线程，调用时不能持有taskQueMtx_
+    void discardTask(const std::shared_ptr<TaskBase>& task, SubmitStatus status);
+    // 任务关联的CancelToken已经取消或超过截止时间时返回对应的状态，否则返回SUBMIT_OK
+    // Result::cancel()在取得执行权时已经处理，这里不检查canceled_，cancel()的返回值才准确
+    static SubmitStatus expiredStatus(const TaskBase& task)
+    {
+        if (task.cancelToken_.isCanceled()) return SubmitStatus::SUBMIT_CANCELED;
+        if (task.deadline_ != std::chrono::steady_clock::time_point::max()
+            && std::chrono::steady_clock::now() >= task.deadline_)
+        {
+            return SubmitStatus::SUBMIT_EXPIRED;
+        }
+        return SubmitStatus::SUBMIT_OK;
+    }
+    // 把提交选项记录到任务中
+    static void applyOptions(TaskBase& task, const TaskOptions& options)
+    {
+        task.priority_ = options.priority;
+        task.cancelToken_ = options.token;
+        task.deadline_ = options.deadline;
+        task.blocking_ = options.blocking;
+    }
+    // Result::cancel()/TaskFuture::cancel()：标记取消，任务还在队列中时立即取得执行权并通知等待的线程
+    // 队列中的记录留在原处，线程取出时发现已经被取得执行权就跳过，不需要在队列中查找
+    template<typename> friend class TaskFuture;
+    bool cancelTask(const std::shared_ptr<TaskBase>& task);
+    // Strand：创建任务，以及由StrandState直接执行任务、提交排空任务
+    friend class Strand;
+    friend class StrandState;
+    friend class GraphRun;
+    friend class ExecutorGroup;
+    friend class GroupScheduler;
+    // BlockingRegion：当前线程进入和离开阻塞区域，进入时按需增加补偿线程，离开时请求多余的线程退出
+    friend class BlockingRegion;
+    void beginBlocking();
+    void endBlocking();
+    // 提交Strand的排空任务，任务队列满或线程池已经关闭时返回false，由调用者在当前线程排空
+    bool submitStrand(const std::shared_ptr<TaskBase>& task);
+    // submitAfter()/submitEvery()：把定时器加入时间轮，第一次使用时创建时间轮，线程池已经关闭时返回SUBMIT_SHUTDOWN
+    friend class TimerWheel;
+    SubmitStatus scheduleTimer(const std::shared_ptr<TaskBase>& task, std::chrono::milliseconds delay);
+    TimerHandle scheduleEvery(std::chrono::milliseconds period, std::function<void()> func);
+    // shutdown()：停止定时线程，取出还没有到期的延迟任务，周期任务不再提交
+    void stopTimer(std::vector<std::shared_ptr<TaskBase>>& pending);
+    // OVERFLOW_SPILL：把溢出队列中的任务移回有空余的任务队列，调用时需持有taskQueMtx_
+    void drainOverflow();
+    // 把一批任务放入任务队列
+    BatchResult enqueueBatch(std::vector<std::shared_ptr<TaskBase>>& tasks, TaskPriority priority);
+    // QUE_LOCKED：某个优先级的任务能否入队(总数和该优先级的数量都没有超过阈值)，调用时需持有taskQueMtx_
+    bool canAdmit(TaskPriority priority) const;
+    // 唤醒最多n个在notEmpty_上等待的线程，调用时需持有taskQueMtx_
+    void notifyWaiting(size_t n);
+    // 线程池线程执行一个从队列取出的任务，任务已经被其他线程直接执行时跳过
+    void runTask(const std::shared_ptr<TaskBase>& task);
+    // 执行任务并记录统计信息，调用前需要已经取得执行权
+    void executeTask(const std::shared_ptr<TaskBase>& task);
+    // 工作窃取模式：从随机选取的其他线程的队列队头窃取任务
+    bool stealTask(int workerIndex, std::shared_ptr<TaskBase>& task);
+    // 不加taskQueMtx_尝试获取任务：自己的队列、无锁任务队列、窃取其他线程的队列
+    bool tryAcquireTask(int workerIndex, std::shared_ptr<TaskBase>& task);
+    // 空闲自旋：进入条件变量等待前自旋等待新任务，返回是否已经不加锁取到任务
+    bool spinForTask(int workerIndex, std::shared_ptr<TaskBase>& task, int& spinLimit);
+    // 指定了NUMA节点的任务放入该节点上一个线程的私有队列，和共享任务队列一样先判断能否入队，满时按policy处理
+    SubmitStatus pushNodeTask(const std::shared_ptr<TaskBase>& task, const std::vector<int>& workers,
+        OverflowPolicy policy, std::chrono::steady_clock::time_point deadline);
+    // 指定了NUMA节点的任务能否入队：所有队列中的任务总数没有超过任务队列阈值，且没有超过分道阈值，调用时需持有taskQueMtx_
+    bool canAdmitNode(TaskPriority priority) const;
+    // 线程私有队列出队后，有提交线程在notFull_上等待时通知它们重新检查
+    void notifySubmitters();
+    // 无锁任务队列入队，队列满时按policy处理
+    SubmitStatus pushLockFree(const std::shared_ptr<TaskBase>& task, OverflowPolicy policy,
+        std::chrono::steady_clock::time_point deadline);
+    // cached模式下创建一个新线程，reserve为true时创建后直接进入保留线程池休眠，调用时需持有taskQueMtx_
+    void addThread(bool reserve = false);
+    // cached模式下扩容一个线程：保留线程池中有休眠的线程时唤醒它，否则创建新线程，调用时需持有taskQueMtx_
+    void activateThread();
+    // 在保留线程池中休眠，直到被activateThread()唤醒(返回true)或线程池关闭(返回false)
+    // 调用前需要已经计入reserveThreadSize_，调用时需持有taskQueMtx_
+    bool parkThread(std::unique_lock<std::mutex>& lock);
+    // 预先创建的保留线程的线程函数：先休眠，被唤醒后和其他线程一样执行threadFunc()
+    void reserveFunc(int threadId);
+    // MODE_CACHED：有任务积压时唤醒休眠中的弹性控制线程，由它决定是否创建线程
+    void requestGrowth();
+    // 弹性控制线程函数：定期检查排队延迟，创建线程或请求空闲线程退出
+    void controllerFunc();
+    // 停止弹性控制线程，之后不会再创建新线程
+    void stopController();
+    // 线程退出前把自己的Thread对象移到exitedThreads_，由其他线程join()，调用时需持有taskQueMtx_
+    void retireThread(int threadId);
+    // join()已经退出的线程，调用时不能持有taskQueMtx_
+    void joinExited();
+    // shutdown()：取出所有队列中还没有执行的任务，调用时需持有taskQueMtx_
+    void takePending(std::vector<std::shared_ptr<TaskBase>>& pending);
+    // 线程启动时取得一个统计计数槽位，退出时归还，槽位和累计的计数在线程池析构前一直保留
+    WorkerStats* acquireStats();
+    void releaseStats(WorkerStats* stats);
+    // 空闲线程数：当前线程数减去各线程计数槽位中正在执行任务的线程数
+    int idleThreads() const;
 
 private:
+    // 成员按访问方式分组，避免伪共享：
+    // 只读为主的配置放在一起，频繁修改的共享计数各自占用缓存行，每个线程的计数放在各自的WorkerStats中，读取时汇总
+
     std::unordered_map<int,std::unique_ptr<Thread>> threads_; // 有映射关系的线程列表
+    std::vector<std::unique_ptr<Thread>> exitedThreads_; // 已经退出、等待join()的线程，由taskQueMtx_保护
+
+    // 只读为主的配置和状态：start()之后基本不再修改，提交线程和工作线程只读取
     size_t initThreadSize_; // 初始线程数量
-    std::atomic_int idleThreadSize_; // 记录空闲线程数
-    std::atomic_int curThreadSize_; // 记录当前线程池里面的线程总数量
     size_t threadSizeThreshold_; // 线程列表中的最大线程数
-
-    std::queue<std::shared_ptr<Task>> taskQue_; // 任务队列，有的任务可能是临时的，将已经析构的任务存入队列中毫无意义,因此用智能指针,拉长对象生命周期并可以自动释放资源
-    std::atomic_uint taskSize_; // 任务数量，用原子操作保证任务队列线程安全（多个线程都要用到因此用原子类型）
     int taskQueMaxThreshold_; // 任务队列最大任务数量
-    
-    std::mutex taskQueMtx_; // 保证任务队列线程安全
+    int laneMaxThreshold_[TASK_PRIORITY_SIZE]; // 每个优先级队列的最大任务数量，0表示不单独限制
+    OverflowPolicy overflowPolicy_; // submitTask()的溢出策略
+    std::chrono::milliseconds submitTimeout_; // OVERFLOW_BLOCK的最长等待时间
+    PoolMode poolMode_; // 当前线程池工作模式
+    TaskQueMode taskQueMode_; // 任务队列实现方式
+    IdlePolicy idlePolicy_; // 线程空闲等待策略
+    std::atomic_bool isPoolRunning_; //表示当前线程池的启动状态（多个线程都要用到因此用原子类型）
+    std::atomic_bool isShutdown_; // 已经调用shutdown()，线程池以外的线程不能再提交任务
+    std::atomic_int curThreadSize_; // 记录当前线程池里面的线程总数量，只在创建和回收线程时修改
+    // 空闲线程数不再由工作线程每执行一个任务修改两次共享计数，而是由各线程的WorkerStats::busy_在读取时汇总(idleThreads())
+
+    // QUE_LOCKFREE：无锁任务队列，代替taskQue_，taskQueMtx_和条件变量只在队列空/满时使用
+    std::unique_ptr<MpmcRingQueue<std::shared_ptr<TaskBase>>> lockFreeQue_;
+    // MODE_STEALING：每个线程私有的任务队列，taskQue_作为外部线程提交任务的注入队列
+    std::vector<std::unique_ptr<WorkStealingQueue>> workQues_;
+    std::unordered_map<int, int> workerIndex_; // 线程id -> workQues_下标，start()之后只读
+    // 线程绑核
+    AffinityPolicy affinityPolicy_;
+    CpuTopology topology_;
+    std::vector<std::vector<int>> nodeWorkers_; // MODE_STEALING：每个NUMA节点上的线程(workQues_下标)，start()之后只读
+
+    // 每次提交和取出任务都要修改的任务数量，单独占用一个缓存行
+    TP_CACHELINE_ALIGN std::atomic_uint taskSize_; // 任务数量，用原子操作保证任务队列线程安全（多个线程都要用到因此用原子类型）
+    // 每次提交都要读取、只在队列空/满时修改的计数，和taskSize_分开，提交线程读取时不会因为taskSize_的修改而失效
+    // 等待线程计数，提交和取出任务时据此只通知需要的线程数量(notify_one)，没有线程等待时不通知
+    TP_CACHELINE_ALIGN std::atomic_int waitingThreadSize_; // 在notEmpty_上等待(或即将等待)的线程数量
+    std::atomic_int waitingSubmitSize_; // 在notFull_上等待的提交线程数量
+    int waitingNodeSubmitSize_; // 其中等待指定NUMA节点的任务入队的线程数量，由taskQueMtx_保护
+    std::atomic<size_t> overflowSize_; // 溢出队列中的任务数，消费者不加锁检查是否需要移回
+
+    // 共享任务队列和保护它的互斥锁、条件变量，持有锁时一起访问，和上面不加锁访问的计数分开
+    TP_CACHELINE_ALIGN std::mutex taskQueMtx_; // 保证任务队列线程安全
     std::condition_variable notFull_; // 表示任务队列不满
     std::condition_variable notEmpty_; // 表示任务队列不空 
     std::condition_variable exitCond_; // 等待线程资源全部回收
+    PriorityTaskQueue taskQue_; // 任务队列(按优先级分道)，有的任务可能是临时的，将已经析构的任务存入队列中毫无意义,因此用智能指针,拉长对象生命周期并可以自动释放资源
+    std::deque<std::shared_ptr<TaskBase>> overflowQue_; // OVERFLOW_SPILL的溢出队列，由taskQueMtx_保护
+    int reapPending_; // 控制线程请求退出的空闲线程数，由taskQueMtx_保护
+    // MODE_CACHED：保留线程池，回收的线程在reserveCond_上休眠，扩容时唤醒，都由taskQueMtx_保护
+    std::condition_variable reserveCond_;
+    std::atomic_int reserveThreadSize_; // 保留线程池中的线程数(包括已经创建、还没有开始休眠的)，stats()不加锁读取
+    int reserveLimit_; // 保留线程数上限，弹性控制线程从elasticPolicy_复制
+    int activatePending_; // 已经请求唤醒、还没有醒来的保留线程数
+    size_t threadStackSize_; // 工作线程栈大小，0表示系统默认值
+    // 阻塞补偿，都由taskQueMtx_保护：补偿线程数不超过阻塞中的线程数，阻塞结束后多出的线程通过retirePending_退出
+    std::atomic_int blockingThreadSize_; // 在阻塞区域中的线程数，stats()不加锁读取
+    int compensation_; // 为阻塞线程增加的线程数
+    int retirePending_; // 阻塞结束后需要退出的多余线程数，空闲线程(MODE_STEALING下只有补偿线程)看到后退出
 
-    PoolMode poolMode_; // 当前线程池工作模式
-    std::atomic_bool isPoolRunning_; //表示当前线程池的启动状态（多个线程都要用到因此用原子类型）
+    // MODE_CACHED：弹性控制线程
+    // 排队时间和最近一次取出任务的时间记录在各线程的WorkerStats中，控制线程检查时汇总
+    TP_CACHELINE_ALIGN std::thread controller_;
+    std::mutex ctrlMtx_; // 保护elasticPolicy_和controllerRunning_，和taskQueMtx_同时持有时先加taskQueMtx_
+    std::condition_variable ctrlCond_;
+    ElasticPolicy elasticPolicy_;
+    bool controllerRunning_;
+    std::atomic_bool controllerParked_; // 控制线程没有任务积压，按较长周期休眠
+
+    // submitAfter()/submitEvery()的时间轮和定时线程，第一次使用时创建
+    std::mutex timerMtx_; // 保护timerWheel_的创建
+    std::shared_ptr<TimerWheel> timerWheel_;
+    // ExecutorGroup共享的公平调度器，第一次创建执行器组时创建
+    std::mutex groupMtx_; // 保护groupScheduler_的创建
+    std::shared_ptr<GroupScheduler> groupScheduler_;
+
+    // 统计信息
+    mutable std::mutex statsMtx_; // 保护workerStats_和freeStats_，和taskQueMtx_同时持有时先加taskQueMtx_
+    std::vector<std::unique_ptr<WorkerStats>> workerStats_; // 所有线程的统计计数槽位
+    std::vector<WorkerStats*> freeStats_; // 已退出线程归还的槽位，新线程优先复用
+    WorkerStats externalStats_; // 线程池以外的线程执行任务时的统计计数
+    alignas(64) std::atomic<uint64_t> submitted_; // 提交相关的计数由用户线程修改，和工作线程的计数分开存放
+    std::atomic<uint64_t> rejected_;
+    std::atomic<uint64_t> submitBlockedNs_;
+    std::atomic<uint64_t> threadSpawns_;
+    std::atomic<uint64_t> threadReaps_;
+    std::atomic<uint64_t> threadActivations_;
+    std::atomic<uint64_t> compensations_;
+    std::atomic<uint64_t> callerRuns_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> spilled_;
+    std::atomic<uint64_t> canceled_;
+    std::atomic<uint64_t> expired_;
+};
+
+// 串行执行器：同一个Strand上提交的任务按提交顺序逐个执行，不会并发执行，代替任务内部的互斥锁
+// 任务放入Strand自己的无锁多生产者单消费者队列，队列从空变为非空的提交者向线程池提交一个排空任务，
+// 排空任务依次执行队列中的任务，连续执行一定数量后重新提交自己，让其他任务有机会执行
+// Strand只占用一个小对象，空闲时不占用线程池的任何资源，可以按连接或分片创建大量Strand
+// 注意：Strand上的任务不能等待同一个Strand上之后提交的任务，否则会死锁
+class StrandState;
+class Strand
+{
+public:
+    Strand() = default;
+    explicit Strand(ThreadPool& pool);
+
+    // 是否关联了线程池
+    bool valid() const { return state_ != nullptr; }
+    // 还没有执行完的任务数量
+    size_t pending() const;
+
+    // 提交任意可调用对象和参数，按提交顺序执行
+    // 返回的TaskFuture不能cancel()，需要取消时在任务中自行判断
+    template<typename F, typename... Args>
+    auto submit(F&& func, Args&&... args)
+        -> TaskFuture<std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    {
+        ThreadPool* pool = poolOf();
+        auto task = pool->makeFuncTask(std::forward<F>(func), std::forward<Args>(args)...);
+        push(task);
+        using R = std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
+        return TaskFuture<R>(std::move(task), pool);
+    }
+
+private:
+    // 关联的线程池
+    ThreadPool* poolOf() const;
+    // 把任务放入队列，队列原来为空时提交排空任务
+    void push(std::shared_ptr<TaskBase> task);
+
+    std::shared_ptr<StrandState> state_;
 };
 
+// 阻塞区域：线程池线程在任务中执行同步IO等会长时间阻塞的操作时创建，线程池临时增加一个补偿线程，
+// 保证可以执行任务的线程数不变；离开作用域时多余的一个空闲线程退出(MODE_CACHED下保留线程池没有满时转入休眠)
+// 补偿线程受setThreadSizeThreshold()的阈值限制；在线程池以外的线程中或嵌套使用时什么也不做
+// {
+//     BlockingRegion blocking;
+//     read(fd, buf, size);
+// }
+class BlockingRegion
+{
+public:
+    BlockingRegion();
+    ~BlockingRegion();
+
+    BlockingRegion(const BlockingRegion&) = delete;
+    BlockingRegion& operator=(const BlockingRegion&) = delete;
+
+private:
+    ThreadPool* pool_; // 进入阻塞区域的线程池，没有进入时为空
+};
+
+// 任务依赖图：先声明节点和依赖关系，之后可以在线程池上反复执行
+// 每次执行时每个节点有一个原子依赖计数，最后一个前驱执行完时该节点立即就绪，不需要按层等待
+// 就绪的后继中第一个直接在完成前驱的线程上继续执行，保持缓存局部性，其余的放入任务队列
+// 执行期间不能修改图，图的生命周期要长于所有还没有执行完的GraphResult
+class GraphRun;
+class GraphResult
+{
+public:
+    GraphResult() = default;
+    GraphResult(std::shared_ptr<GraphRun> run, ThreadPool* pool) : run_(std::move(run)), pool_(pool) {}
+
+    // 是否关联了一次执行
+    bool valid() const { return run_ != nullptr; }
+    // 所有节点是否都已经执行完
+    bool isReady() const;
+    // 阻塞直到所有节点执行完，等待期间帮忙执行线程池中的其他任务
+    // 有节点抛出异常时，之后就绪的节点不再执行(只向后继传递完成)，这里重新抛出第一个异常
+    void wait();
+
+private:
+    std::shared_ptr<GraphRun> run_;
+    ThreadPool* pool_ = nullptr;
+};
+
+class TaskGraph
+{
+public:
+    // 添加节点，返回节点编号(从0开始)
+    int addNode(std::function<void()> func);
+    // 添加依赖：节点from执行完之后才执行节点to
+    void addEdge(int from, int to);
+    // 节点数量
+    size_t size() const { return nodes_.size(); }
+
+    // 在线程池上执行一次整个图，没有前驱的节点放入任务队列后立即返回
+    // 图中有环时抛出std::logic_error
+    GraphResult run(ThreadPool& pool);
+
+private:
+    friend class GraphRun;
+    struct Node
+    {
+        std::function<void()> func_;
+        std::vector<int> successors_; // 依赖这个节点的节点
+        int predecessorSize_ = 0; // 依赖的节点数量
+    };
+    // 检查图中是否有环
+    bool isAcyclic() const;
+
+    std::vector<Node> nodes_;
+    std::vector<int> roots_; // 没有前驱的节点，检查过没有环之后记录
+    bool checked_ = false; // 修改之后是否已经检查过没有环
+};
+
+// 执行器组：同一个进程中的多个逻辑线程池(例如IO、计算、后台任务)共享一个ThreadPool的线程，不再各自创建线程
+// 每个组有自己的任务队列和排队上限，组的任务放入组队列，同时向线程池提交一个调度任务；
+// 调度任务执行时按权重公平调度(stride调度)选出一个组，执行它队头的任务，各组得到的线程时间与权重成正比
+// 空闲的组不积累份额，重新有任务时从当前进度开始；线程总数就是线程池的线程数，默认为CPU核心数
+// 组可以在任意时刻创建，生命周期不能长于线程池
+class GroupState;
+class ExecutorGroup
+{
+public:
+    ExecutorGroup() = default;
+    // weight：权重(至少为1)；maxQueued：组内最多排队的任务数，0表示不单独限制
+    ExecutorGroup(ThreadPool& pool, int weight = 1, size_t maxQueued = 0);
+
+    // 是否关联了线程池
+    bool valid() const { return state_ != nullptr; }
+    // 组内排队的任务数量，包括已经取消、还没有被调度任务跳过的记录
+    size_t pending() const;
+    // 修改权重，之后的调度生效
+    void setWeight(int weight);
+
+    // 提交任意可调用对象和参数到这个组，组内按提交顺序开始执行
+    // 组队列满时返回状态为SUBMIT_QUEUE_FULL的TaskFuture；调度任务按线程池的溢出策略提交，没有提交成功时返回对应的状态
+    template<typename F, typename... Args>
+    auto submit(F&& func, Args&&... args)
+        -> TaskFuture<std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    {
+        ThreadPool* pool = poolOf();
+        auto task = pool->makeFuncTask(std::forward<F>(func), std::forward<Args>(args)...);
+        SubmitStatus status = push(task);
+        if (!ThreadPool::isAccepted(status))
+        {
+            task->fail(std::make_exception_ptr(std::runtime_error(submitStatusText(status))));
+        }
+        using R = std::decay_t<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
+        return TaskFuture<R>(std::move(task), pool);
+    }
+
+private:
+    // 关联的线程池
+    ThreadPool* poolOf() const;
+    // 把任务放入组队列并提交调度任务
+    SubmitStatus push(const std::shared_ptr<TaskBase>& task);
+
+    std::shared_ptr<GroupState> state_;
+};
+
+// 阻塞直到任务执行完，等待期间帮忙执行线程池中的其他任务
+template<typename R>
+void TaskFuture<R>::wait() const
+{
+    if (state_->isReady()) return;
+    if (pool_ == nullptr)
+    {
+        state_->wait();
+        return;
+    }
+    FutureState<R>* state = state_.get();
+    pool_->helpWait(state_, [state]() { return state->isReady(); }, [state]() { state->wait(); });
+}
+
+// 取消任务
+template<typename R>
+bool TaskFuture<R>::cancel()
+{
+    if (state_ == nullptr || pool_ == nullptr) return false;
+    return pool_->cancelTask(state_);
+}
+
+// 任务执行完后把返回值交给func(Any)，func作为新任务提交到同一个线程池
+template<typename F>
+Result Result::then(F&& func)
+{
+    auto next = makeTask<ContinuationTask<std::decay_t<F>>>(std::decay_t<F>(std::forward<F>(func)));
+    if (!isValid_)
+    {
+        return Result(next, false, pool_);
+    }
+    ThreadPool* pool = pool_;
+    // 回调里只保存next，不保存前一个任务，避免任务和回调之间的循环引用
+    task_->addCallback([next, pool](Task& prev) {
+        next->input_ = prev.takeVal();
+        if (pool != nullptr)
+        {
+            pool->submitContinuation(next);
+        }
+        else
+        {
+            next->exec();
+        }
+    });
+    return Result(next, true, pool_);
+}
+
+// 没有提交成功或任务已经执行完时不挂起
+inline bool Result::Awaiter::await_ready() const
+{
+    return !result_.isValid_ || result_.task_->done_.isSet();
+}
+
+// 挂起等待任务执行完：在setVal()的回调中取走返回值，把恢复协程的任务提交到线程池
+// 任务已经执行完时回调在当前线程立即执行；没有关联线程池时直接在完成任务的线程上恢复
+template<typename Handle>
+void Result::Awaiter::await_suspend(Handle handle)
+{
+    ThreadPool* pool = result_.pool_;
+    result_.task_->addCallback([this, handle, pool](Task& task) {
+        value_ = task.takeVal();
+        resumed_ = true;
+        if (pool != nullptr)
+        {
+            pool->submitContinuation(makeTask<ResumeTask<Handle>>(handle, nullptr));
+        }
+        else
+        {
+            handle.resume();
+        }
+    });
+}
+
+#if defined(__cpp_impl_coroutine)
+// co_await result / co_await pool.submitTask(task)：挂起协程直到任务执行完，结果为任务的返回值
+inline Result::Awaiter operator co_await(Result& result)
+{
+    return Result::Awaiter(result);
+}
+inline Result::Awaiter operator co_await(Result&& result)
+{
+    return Result::Awaiter(result);
+}
+#endif
+
 #endif